@@ -0,0 +1,290 @@
+"""
+module to benchmark the hot paths of the liveview, headless on the Qt offscreen platform; results can be written to json
+and compared against those of another commit
+"""
+import io
+import os
+import sys
+import json
+import platform
+import threading
+import subprocess
+import tracemalloc
+from time import sleep, perf_counter
+from types import SimpleNamespace
+from argparse import ArgumentParser
+import numpy as np
+
+ROI_COUNTS = (1, 5, 10, 50)
+# (height, width) of the Quadro and of larger Eiger2 detectors
+GEOMETRIES = {'512x512': (512, 512), '1062x1028': (1062, 1028), '2162x2068': (2162, 2068)}
+
+
+def parse_args():
+    parser = ArgumentParser()
+    parser.add_argument('benchmarks', type=str, nargs='*', help='benchmarks to run, all if omitted')
+    parser.add_argument('--repeat', type=int, default=200, help='number of timed calls per benchmark')
+    parser.add_argument('--output', type=str, help='json file to write the results to')
+    parser.add_argument('--compare', type=str, help='json file of earlier results to compare to')
+    args = parser.parse_args()
+    return args
+
+
+def time_call(f, repeat):
+    """
+    returns the median time per call of f in seconds
+    """
+    f()
+    times = np.empty(repeat)
+    for i in range(repeat):
+        t0 = perf_counter()
+        f()
+        times[i] = perf_counter() - t0
+    return float(np.median(times))
+
+
+def traced_bytes(f):
+    """
+    returns the peak memory allocated during a call of f in bytes, as traced by tracemalloc
+    """
+    f()
+    tracemalloc.start()
+    try:
+        f()
+        return tracemalloc.get_traced_memory()[1]
+    finally:
+        tracemalloc.stop()
+
+
+def sample_image(shape=(512, 512), dtype=np.uint16, seed=0):
+    return np.random.default_rng(seed).poisson(1000, shape).astype(dtype)
+
+
+def qt_app():
+    """
+    returns the QApplication, created on the offscreen platform unless QT_QPA_PLATFORM is set
+    """
+    os.environ.setdefault('QT_QPA_PLATFORM', 'offscreen')
+    import pyqtgraph as pg
+    return pg.mkQApp()
+
+
+def bench_tiff(repeat):
+    """
+    decoding monitor images with PIL compared to the TiffDecoder
+    """
+    from PIL import Image
+    from .lib.Tiff import TiffDecoder, encode_tiff
+    from .lib.Utils import monitor_to_array
+    data = encode_tiff(sample_image())
+    results = {'monitor_to_array': time_call(lambda: monitor_to_array(data), repeat)}
+    for dtype in (np.uint16, np.uint32):
+        data = encode_tiff(sample_image(dtype=dtype))
+        decoder = TiffDecoder()
+        results[f'pil_{np.dtype(dtype).name}'] = time_call(
+            lambda: np.rot90(np.array(Image.open(io.BytesIO(data))), k=3), repeat)
+        results[f'decoder_{np.dtype(dtype).name}'] = time_call(lambda: decoder.decode(data), repeat)
+        results[f'memcpy_{np.dtype(dtype).name}'] = time_call(lambda: bytearray(data), repeat)
+    return results
+
+
+def bench_decode_pool(repeat):
+    """
+    time per frame for decoding stream images inline compared to DecodePool with 1, 2, 4 and 8 worker processes; the
+    images are lz4 compressed if lz4 is installed and uncompressed otherwise
+    """
+    from .lib.Stream import decode_stream_image
+    from .lib.DecodePool import DecodePool
+    from .lib.Buffers import FrameRingBuffer
+    image = sample_image((2048, 2048))
+    header = {'htype': 'dimage_d-1.0', 'shape': [2048, 2048], 'type': 'uint16', 'encoding': 'lz4<'}
+    try:
+        import lz4.block
+        data = lz4.block.compress(image.tobytes(), store_size=False)
+    except ImportError:
+        header['encoding'], data = '<', image.tobytes()
+    frames = FrameRingBuffer(16)
+
+    t0 = perf_counter()
+    for _ in range(repeat):
+        frames.push(decode_stream_image(header, data))
+    results = {'inline': (perf_counter() - t0) / repeat}
+
+    for n_workers in (1, 2, 4, 8):
+        if n_workers > os.cpu_count():
+            break
+        done = threading.Semaphore(0)
+
+        def deliver(frame, tag):
+            frames.push(frame)
+            done.release()
+
+        pool = DecodePool(deliver, n_workers)
+        # warm up the workers and allocate the slots
+        for _ in range(n_workers):
+            pool.submit(data, header)
+        for _ in range(n_workers):
+            done.acquire()
+        t0 = perf_counter()
+        for _ in range(repeat):
+            pool.submit(data, header)
+        for _ in range(repeat):
+            done.acquire()
+        results[f'pool_{n_workers}'] = (perf_counter() - t0) / repeat
+        pool.close()
+    return results
+
+
+def bench_set_image(repeat):
+    """
+    ImageViewWidget.setImage in linear, log and sqrt scale, with and without projections
+    """
+    app = qt_app()
+    from .ui.widgets import ImageViewWidget
+    viewer = ImageViewWidget()
+    viewer.resize(800, 800)
+    viewer.show()
+    image = sample_image()
+    results = {}
+    for scale in ('lin', 'log', 'sqrt'):
+        getattr(viewer.view.menu, f'{scale}Scale').setChecked(True)
+        for projections in (False, True):
+            results[f'{scale}{"_projections" if projections else ""}'] = time_call(
+                lambda: viewer.setImage(image, projections=projections), repeat)
+    # the same including the repaint
+    viewer.view.menu.linScale.setChecked(True)
+    results['lin_painted'] = time_call(lambda: (viewer.setImage(image), app.processEvents()), repeat)
+    viewer.close()
+    return results
+
+
+def bench_geometry(repeat):
+    """
+    time and memory of ImageViewWidget.setImage per frame for growing detector geometries, next to a full-frame copy;
+    memory cases end in _bytes
+    """
+    qt_app()
+    from .ui.widgets import ImageViewWidget
+    viewer = ImageViewWidget()
+    viewer.resize(800, 800)
+    viewer.show()
+    results = {}
+    for geometry, shape in GEOMETRIES.items():
+        image = sample_image(shape)
+        # frames come as read-only views into the frame buffer
+        image.flags.writeable = False
+        results[f'copy_{geometry}'] = time_call(lambda: image.copy(), repeat)
+        results[f'copy_{geometry}_bytes'] = traced_bytes(lambda: image.copy())
+        results[f'set_image_{geometry}'] = time_call(lambda: viewer.setImage(image), repeat)
+        results[f'set_image_{geometry}_bytes'] = traced_bytes(lambda: viewer.setImage(image))
+    viewer.close()
+    return results
+
+
+def bench_roi(repeat):
+    """
+    RectROI.add_mean and LiveViewUi.update_roi for all of 1 to 50 ROIs on one image
+    """
+    qt_app()
+    import pyqtgraph as pg
+    from .lib.Utils import RectROI
+    from .ui.widgets import ImageViewWidget, ROIView
+    from .ui.liveview import LiveViewUi
+    image = sample_image()
+    results = {}
+    for n in ROI_COUNTS:
+        viewer = ImageViewWidget()
+        viewer.setImage(image)
+        roi_view = ROIView()
+        ui = SimpleNamespace(image=image, viewer=viewer)
+        rng = np.random.default_rng(n)
+        rois = []
+        for x, y in rng.uniform(50, 400, (n, 2)):
+            roi = RectROI((x, y), (60, 40), pen=pg.mkPen('c'))
+            viewer.addItem(roi)
+            roi.plot_item = roi_view.addPlot()
+            rois.append(roi)
+        results[f'add_mean_{n}'] = time_call(lambda: [roi.add_mean(image, viewer.imageItem) for roi in rois], repeat)
+        results[f'update_roi_{n}'] = time_call(lambda: [LiveViewUi.update_roi(ui, roi) for roi in rois], repeat)
+    return results
+
+
+def bench_rearrange(repeat):
+    """
+    ROIView.rearrange with 1 to 50 plots
+    """
+    qt_app()
+    from .ui.widgets import ROIView
+    results = {}
+    for n in ROI_COUNTS:
+        roi_view = ROIView()
+        for _ in range(n):
+            roi_view.addPlot()
+        results[f'plots_{n}'] = time_call(roi_view.rearrange, repeat)
+    return results
+
+
+def bench_grabber(repeat):
+    """
+    time per frame of the simulated DectrisImageGrabber running unthrottled, including the frame buffer
+    """
+    qt_app()
+    from .lib.Utils import DectrisImageGrabber
+    results = {}
+    for dtype in ('uint16', 'uint32'):
+        # nothing listens on port 1, the grabber falls back to the simulator
+        grabber = DectrisImageGrabber('localhost', 1, simulation={'rate': 0, 'shape': (512, 512), 'dtype': dtype})
+        grabber.image_grabber_thread.start()
+        while grabber.frames.n_produced < 10:
+            sleep(0.001)
+        n0, t0 = grabber.frames.n_produced, perf_counter()
+        while grabber.frames.n_produced < n0 + repeat:
+            sleep(0.001)
+        results[f'simulated_{dtype}'] = (perf_counter() - t0) / (grabber.frames.n_produced - n0)
+        grabber.image_grabber_thread.requestInterruption()
+        grabber.image_grabber_thread.wait()
+    return results
+
+
+BENCHMARKS = {'tiff': bench_tiff, 'decode_pool': bench_decode_pool, 'set_image': bench_set_image,
+              'geometry': bench_geometry, 'roi': bench_roi, 'rearrange': bench_rearrange, 'grabber': bench_grabber}
+
+
+def environment():
+    """
+    commit and versions the results were taken with
+    """
+    try:
+        commit = subprocess.run(['git', 'rev-parse', '--short', 'HEAD'], capture_output=True, text=True,
+                                cwd=os.path.dirname(__file__)).stdout.strip()
+    except OSError:
+        commit = ''
+    return {'commit': commit, 'python': sys.version.split()[0], 'numpy': np.__version__,
+            'platform': platform.platform(), 'processor': platform.processor(), 'cpus': os.cpu_count()}
+
+
+def run():
+    args = parse_args()
+    reference = {}
+    if args.compare:
+        with open(args.compare) as f:
+            reference = json.load(f)['results']
+    results = {}
+    for name in args.benchmarks or BENCHMARKS:
+        results[name] = BENCHMARKS[name](args.repeat)
+        for case, t in results[name].items():
+            if case.endswith('_bytes'):
+                line = f'{name:>12s} {case:<24s} {t / 2**20:10.2f} MB'
+            else:
+                line = f'{name:>12s} {case:<24s} {t * 1e6:10.1f} us'
+            if case in reference.get(name, {}):
+                line += f' {t / reference[name][case]:6.2f}x'
+            print(line)
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump({**environment(), 'repeat': args.repeat, 'unit': 's, bytes for the _bytes cases',
+                       'results': results}, f, indent=2)
+
+
+if __name__ == '__main__':
+    run()
@@ -12,7 +12,7 @@ from nidaqmx.stream_writers import AnalogSingleChannelWriter
 import numpy as np
 import ctypes
 import threading
-from uedinst.dectris import Quadro
+from .lib.Simplon import get_detector
 from . import IP, PORT
 
 
@@ -99,7 +99,7 @@ def run(cmd_args):
     wait_time = cmd_args.wait_time
 
     # prepare detector for experiment
-    Q = Quadro(cmd_args.dcu_ip, cmd_args.dcu_port)
+    Q = get_detector(cmd_args.dcu_ip, cmd_args.dcu_port)
     if cmd_args.n_images <= 1000:
         Q.fw.nimages_per_file = 0
     else:
@@ -0,0 +1,128 @@
+"""
+buffers for handing frames from acquisition to display without allocating memory per frame
+"""
+import threading
+import numpy as np
+
+
+class FrameRingBuffer:
+    """
+    fixed capacity ring of preallocated frames with sequence numbers; pushing into a full buffer drops the oldest
+    unread frame. the frame handed out by pop or pop_latest is leased: it is a read-only view into a slot that is not
+    written again until the next pop, one slot more than capacity is allocated for it
+    """
+    def __init__(self, capacity=8):
+        self.capacity = capacity
+        self.frames = None
+        self.sequence = np.full(capacity + 1, -1, dtype=np.int64)
+        # metadata pushed along with the frames, e.g. their trigger index
+        self.infos = [None] * (capacity + 1)
+        # slot of the frame handed out last, skipped by push
+        self.leased = None
+        self.lock = threading.Lock()
+        self.n_produced = 0
+        self.n_consumed = 0
+        self.n_dropped = 0
+        # sequence number of the oldest unread frame
+        self.read_seq = 0
+
+    def __len__(self):
+        """
+        number of unread frames
+        """
+        return self.n_produced - self.read_seq
+
+    def __allocate(self, shape, dtype):
+        # a leased frame keeps the memory of the old frames alive
+        self.frames = np.empty((self.capacity + 1, *shape), dtype=dtype)
+        self.sequence[:] = -1
+        self.leased = None
+        self.n_dropped += self.n_produced - self.read_seq
+        self.read_seq = self.n_produced
+
+    def __slot(self, seq):
+        slots = np.flatnonzero(self.sequence == seq)
+        return slots[0] if slots.size else None
+
+    def __view(self, seq, lease=False):
+        slot = self.__slot(seq)
+        if lease:
+            self.leased = slot
+        view = self.frames[slot]
+        view.flags.writeable = False
+        return seq, view
+
+    def push(self, frame, info=None):
+        """
+        copies frame into the slot of the oldest frame that is not leased, keeping info with it, and returns its
+        sequence number; the ring is reallocated if the geometry or dtype of the frames changes
+        """
+        with self.lock:
+            if self.frames is None or self.frames.shape[1:] != frame.shape or self.frames.dtype != frame.dtype:
+                self.__allocate(frame.shape, frame.dtype)
+            seq = self.n_produced
+            if seq - self.read_seq >= self.capacity:
+                self.n_dropped += 1
+                self.read_seq += 1
+            # capacity slots besides the leased one hold at most capacity - 1 unread frames, so this one is read
+            sequence = self.sequence.copy()
+            if self.leased is not None:
+                sequence[self.leased] = np.iinfo(np.int64).max
+            slot = int(np.argmin(sequence))
+            np.copyto(self.frames[slot], frame)
+            self.sequence[slot] = seq
+            self.infos[slot] = info
+            self.n_produced += 1
+            return seq
+
+    def pop(self, lease=True):
+        """
+        returns (sequence number, frame) of the oldest unread frame or None; without lease its slot can be written by
+        the next push already, so the frame has to be copied before more are pushed
+        """
+        with self.lock:
+            if self.read_seq == self.n_produced:
+                return None
+            self.read_seq += 1
+            self.n_consumed += 1
+            return self.__view(self.read_seq - 1, lease)
+
+    def pop_latest(self, lease=True):
+        """
+        returns (sequence number, frame) of the newest unread frame or None, older unread frames count as dropped
+        """
+        with self.lock:
+            if self.read_seq == self.n_produced:
+                return None
+            self.n_dropped += self.n_produced - 1 - self.read_seq
+            self.read_seq = self.n_produced
+            self.n_consumed += 1
+            return self.__view(self.n_produced - 1, lease)
+
+    def info(self, seq):
+        """
+        returns the info pushed with frame seq, None if there was none or the frame was overwritten already
+        """
+        with self.lock:
+            slot = self.__slot(seq)
+            return None if slot is None else self.infos[slot]
+
+    def recent(self, n=None):
+        """
+        returns up to n (sequence number, frame) of the newest frames, oldest first, without consuming or leasing
+        them; the frames are copies, their slots are written again by later pushes
+        """
+        with self.lock:
+            if self.frames is None:
+                return []
+            n = self.capacity if n is None else min(n, self.capacity)
+            frames = []
+            for seq in range(max(self.n_produced - n, 0), self.n_produced):
+                slot = self.__slot(seq)
+                if slot is not None:
+                    frames.append((seq, self.frames[slot].copy()))
+            return frames
+
+    def stats(self):
+        return {'produced': self.n_produced, 'consumed': self.n_consumed, 'dropped': self.n_dropped,
+                'unread': len(self)}
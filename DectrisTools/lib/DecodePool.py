@@ -0,0 +1,114 @@
+"""
+pool of worker processes decoding frames into shared memory, keeping decoding out of the GIL of the acquisition
+"""
+import threading
+import logging as log
+import multiprocessing
+from multiprocessing import shared_memory
+from queue import Queue
+import numpy as np
+from .Tiff import TiffDecoder, read_tags
+from .Stream import decode_stream_image
+
+# decoder of each worker process
+WORKER_DECODER = TiffDecoder()
+
+
+def decode_into(shm_name, data, header=None):
+    """
+    runs in the worker processes: decodes tif data, or stream data according to its dimage_d header, into the shared
+    memory block shm_name and returns the shape and dtype of the image
+    """
+    image = WORKER_DECODER.decode(data) if header is None else decode_stream_image(header, data)
+    shm = shared_memory.SharedMemory(name=shm_name)
+    try:
+        out = np.ndarray(image.shape, dtype=image.dtype, buffer=shm.buf)
+        np.copyto(out, image)
+        del out
+    finally:
+        shm.close()
+    return image.shape, image.dtype.str
+
+
+class DecodePool:
+    """
+    decoding frames in n_workers processes into n_slots shared memory slots; a delivery thread hands the decoded
+    frames to deliver(frame, tag) in the order they were submitted, as views that are only valid during the call
+    """
+    def __init__(self, deliver, n_workers=2, n_slots=None):
+        self.deliver = deliver
+        self.n_workers = n_workers
+        self.n_slots = n_slots or 2 * n_workers
+        # spawned workers do not inherit the Qt threads of the parent process
+        self.pool = multiprocessing.get_context('spawn').Pool(n_workers)
+        self.slots = []
+        self.slot_size = 0
+        self.free = Queue()
+        self.pending = Queue()
+        self.layouts = TiffDecoder()
+        self.delivery_thread = threading.Thread(target=self.__deliver, daemon=True)
+        self.delivery_thread.start()
+
+    def __del__(self):
+        self.close()
+
+    def close(self):
+        if self.pool is None:
+            return
+        self.pending.put(None)
+        self.delivery_thread.join()
+        self.pool.terminate()
+        self.pool = None
+        for shm in self.slots:
+            shm.close()
+            shm.unlink()
+        self.slots = []
+
+    def __nbytes(self, data, header):
+        if header is not None:
+            return int(np.prod(header['shape'])) * np.dtype(header['type']).itemsize
+        layout = self.layouts.layout(data)
+        if layout is not None:
+            _, dtype, shape = layout
+            return shape[0] * shape[1] * dtype.itemsize
+        _, tags = read_tags(data)
+        return tags[256][0] * tags[257][0] * tags.get(258, (8,))[0] // 8
+
+    def __allocate_slots(self, size):
+        """
+        waits until all slots are free and replaces them by slots of size bytes
+        """
+        for _ in self.slots:
+            self.free.get()
+        for shm in self.slots:
+            shm.close()
+            shm.unlink()
+        self.slots = [shared_memory.SharedMemory(create=True, size=size) for _ in range(self.n_slots)]
+        self.slot_size = size
+        for slot in range(self.n_slots):
+            self.free.put(slot)
+
+    def submit(self, data, header=None, tag=None):
+        """
+        queues tif data, or stream data with its dimage_d header, for decoding; blocks while all slots are in use. tag
+        is handed to deliver along with the frame
+        """
+        nbytes = self.__nbytes(data, header)
+        if nbytes > self.slot_size:
+            self.__allocate_slots(nbytes)
+        slot = self.free.get()
+        self.pending.put((self.pool.apply_async(decode_into, (self.slots[slot].name, data, header)), slot, tag))
+
+    def __deliver(self):
+        while True:
+            item = self.pending.get()
+            if item is None:
+                return
+            result, slot, tag = item
+            try:
+                shape, dtype = result.get()
+                self.deliver(np.ndarray(shape, dtype=dtype, buffer=self.slots[slot].buf), tag)
+            except Exception as e:
+                log.error(f'decoding frame failed: {e}')
+            finally:
+                self.free.put(slot)
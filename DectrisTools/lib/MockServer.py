@@ -0,0 +1,381 @@
+"""
+local stand-in for the SIMPLON REST API of the DCU, covering the detector, monitor, filewriter and stream endpoints
+used by DectrisTools, for benchmarking the whole http path without hardware
+"""
+import io
+import json
+import re
+import logging as log
+import threading
+from time import sleep, perf_counter
+from collections import deque
+from http.server import ThreadingHTTPServer, BaseHTTPRequestHandler
+import numpy as np
+from .Simplon import SIMPLON_API, NEXT_IMAGE_WAIT
+from .Simulator import DetectorSimulator
+from .Tiff import encode_tiff
+
+# time the initialize command takes
+INITIALIZE_TIME = 1
+DETECTOR_CONFIG = {'description': 'Dectris Quadro Si 512x512 (simulated)', 'count_time': 0.3, 'frame_time': 0.3,
+                   'trigger_mode': 'ints', 'ntrigger': 1, 'nimages': 1, 'counting_mode': 'normal',
+                   'incident_energy': 1e5, 'compression': 'bslz4'}
+MONITOR_CONFIG = {'mode': 'enabled', 'buffer_size': 10}
+FILEWRITER_CONFIG = {'mode': 'disabled', 'nimages_per_file': 1000, 'name_pattern': 'series_$id'}
+STREAM_CONFIG = {'mode': 'disabled'}
+URL_PATTERN = re.compile(rf'^/(\w+)/api/{re.escape(SIMPLON_API)}/(\w+)(?:/(.*))?$')
+
+
+class MockDCU:
+    """
+    state of the simulated detector: arm, trigger and disarm move it between the idle, ready and acquire states;
+    images of the DetectorSimulator end up in the monitor buffer, in hdf5 files of the filewriter and on the stream
+    """
+    def __init__(self, simulator=None, ext_rate=10, initialized=True, stream_port=None):
+        self.simulator = simulator or DetectorSimulator(rate=0)
+        self.tiff_bank = [encode_tiff(frame) for frame in self.simulator.bank]
+        self.ext_rate = ext_rate
+        self.config = {'detector': dict(DETECTOR_CONFIG), 'monitor': dict(MONITOR_CONFIG),
+                       'filewriter': dict(FILEWRITER_CONFIG), 'stream': dict(STREAM_CONFIG)}
+        self.state = 'idle' if initialized else 'na'
+        self.lock = threading.RLock()
+        self.new_image = threading.Condition(self.lock)
+        self.abort_event = threading.Event()
+        self.series = 0
+        self.n_triggered = 0
+        self.n_images = 0
+        # (series, image id, tif, number of the image since start) of the images in the monitor buffer
+        self.monitor = deque(maxlen=self.config['monitor']['buffer_size'])
+        self.n_monitored = 0
+        # number of the last image returned by images/next
+        self.n_next = 0
+        self.series_frames = []
+        self.files = {}
+        self.ext_trigger_thread = None
+        self.publisher = None
+        if stream_port is not None:
+            from .Stream import StreamPublisher
+            self.publisher = StreamPublisher(stream_port)
+
+    def get(self, subsystem, section, param):
+        """
+        returns the value of a config or status parameter, KeyError if there is none
+        """
+        with self.lock:
+            if section == 'config':
+                return self.config[subsystem][param]
+            if section == 'status' and param == 'state':
+                if subsystem == 'detector':
+                    return self.state
+                if subsystem == 'filewriter':
+                    return 'disabled' if self.config['filewriter']['mode'] == 'disabled' else 'ready'
+                if subsystem == 'monitor':
+                    return 'normal' if len(self.monitor) < self.monitor.maxlen else 'overflow'
+                return 'ready' if self.config['stream']['mode'] == 'enabled' else 'disabled'
+        raise KeyError(param)
+
+    def set(self, subsystem, param, value):
+        """
+        sets a config parameter and returns the list of parameters changed along with it, like the DCU
+        """
+        with self.lock:
+            config = self.config[subsystem]
+            if param not in config:
+                raise KeyError(param)
+            config[param] = value
+            changed = [param]
+            if subsystem == 'detector' and param == 'count_time' and config['frame_time'] < value:
+                config['frame_time'] = value
+                changed.append('frame_time')
+            elif subsystem == 'detector' and param == 'frame_time' and config['count_time'] > value:
+                config['count_time'] = value
+                changed.append('count_time')
+            elif subsystem == 'monitor' and param == 'buffer_size':
+                self.monitor = deque(self.monitor, maxlen=value)
+            return changed
+
+    def command(self, subsystem, name):
+        """
+        runs a command and returns its response, blocking like the DCU for initialize and trigger
+        """
+        if subsystem == 'monitor' and name == 'clear':
+            with self.lock:
+                self.monitor.clear()
+                self.n_next = self.n_monitored
+        elif subsystem == 'filewriter' and name == 'clear':
+            with self.lock:
+                self.files.clear()
+        elif subsystem != 'detector':
+            raise KeyError(name)
+        elif name == 'initialize':
+            self.abort()
+            sleep(INITIALIZE_TIME)
+            with self.lock:
+                self.state = 'idle'
+        elif name == 'arm':
+            return self.arm()
+        elif name == 'trigger':
+            self.trigger()
+        elif name == 'disarm':
+            self.end_series()
+        elif name in ('abort', 'cancel'):
+            self.abort()
+        else:
+            raise KeyError(name)
+        return None
+
+    def arm(self):
+        with self.lock:
+            if self.state != 'idle':
+                raise RuntimeError(f'cannot arm in state {self.state}')
+            self.series += 1
+            self.n_triggered = 0
+            self.n_images = 0
+            self.series_frames = []
+            self.abort_event.clear()
+            self.state = 'ready'
+            if self.publisher is not None and self.config['stream']['mode'] == 'enabled':
+                self.publisher.send_header(self.series)
+            if self.config['detector']['trigger_mode'] in ('exts', 'exte'):
+                self.ext_trigger_thread = threading.Thread(target=self.__ext_triggers, daemon=True)
+                self.ext_trigger_thread.start()
+            return {'sequence id': self.series}
+
+    def trigger(self):
+        with self.lock:
+            if self.state != 'ready':
+                raise RuntimeError(f'cannot trigger in state {self.state}')
+            config = self.config['detector']
+            if config['trigger_mode'] != 'ints':
+                raise RuntimeError(f'trigger command in trigger mode {config["trigger_mode"]}')
+        self.__acquire(config['nimages'], config['frame_time'])
+
+    def __ext_triggers(self):
+        """
+        external trigger generator, exts triggers nimages frames of frame_time, exte one frame of 1/ext_rate
+        """
+        period = 1 / self.ext_rate
+        t_next = perf_counter()
+        while True:
+            with self.lock:
+                if self.state != 'ready':
+                    return
+                config = self.config['detector']
+            if config['trigger_mode'] == 'exts':
+                self.__acquire(config['nimages'], config['frame_time'])
+            else:
+                self.__acquire(1, period)
+            t_next += period
+            if self.abort_event.wait(max(t_next - perf_counter(), 0)):
+                return
+
+    def __acquire(self, n_frames, frame_time):
+        """
+        exposes n_frames one after the other and ends the series after the last trigger
+        """
+        with self.lock:
+            self.state = 'acquire'
+        t_next = perf_counter()
+        for _ in range(n_frames):
+            t_next += frame_time
+            if self.abort_event.wait(max(t_next - perf_counter(), 0)):
+                return
+            self.__add_frame()
+        with self.lock:
+            if self.state != 'acquire':
+                return
+            self.n_triggered += 1
+            self.state = 'ready'
+            if self.n_triggered >= self.config['detector']['ntrigger']:
+                self.end_series()
+
+    def __add_frame(self):
+        index = self.simulator.n_produced % len(self.tiff_bank)
+        frame = self.simulator.next_frame()
+        with self.lock:
+            self.n_images += 1
+            if self.config['monitor']['mode'] == 'enabled':
+                self.n_monitored += 1
+                self.monitor.append((self.series, self.n_images, self.tiff_bank[index], self.n_monitored))
+                self.new_image.notify_all()
+            if self.config['filewriter']['mode'] == 'enabled':
+                self.series_frames.append(frame)
+            if self.publisher is not None and self.config['stream']['mode'] == 'enabled':
+                self.publisher.send_image(frame, self.series, self.n_images - 1)
+
+    def end_series(self):
+        """
+        returns to idle, writing the files of the series if the filewriter is enabled
+        """
+        with self.lock:
+            if self.state not in ('ready', 'acquire'):
+                return
+            self.state = 'idle'
+            self.abort_event.set()
+            if self.series_frames:
+                self.__write_files()
+            if self.publisher is not None and self.config['stream']['mode'] == 'enabled':
+                self.publisher.send_end(self.series)
+
+    def abort(self):
+        with self.lock:
+            self.abort_event.set()
+            if self.state in ('ready', 'acquire'):
+                self.state = 'idle'
+
+    def __write_files(self):
+        """
+        master file, and data files of nimages_per_file images unless that is 0; without h5py the files only hold the
+        raw pixel data, which is still enough for benchmarking downloads
+        """
+        config = self.config['filewriter']
+        name = config['name_pattern'].replace('$id', str(self.series))
+        frames = np.stack(self.series_frames)
+        self.series_frames = []
+        n_per_file = config['nimages_per_file'] or len(frames)
+        if config['nimages_per_file'] == 0:
+            self.files[f'{name}_master.h5'] = to_hdf5(frames)
+            return
+        self.files[f'{name}_master.h5'] = to_hdf5(None)
+        for i, start in enumerate(range(0, len(frames), n_per_file)):
+            self.files[f'{name}_data_{i + 1:06d}.h5'] = to_hdf5(frames[start:start + n_per_file])
+
+    def image_list(self):
+        with self.lock:
+            return [[series, image_id] for series, image_id, _, _ in self.monitor]
+
+    def image(self, *ids):
+        """
+        returns a tif from the monitor by 'monitor' for the last one, 'next' for the oldest one not returned by 'next'
+        yet or series and image id, None if there is none
+        """
+        with self.lock:
+            if ids == ('monitor',):
+                return self.monitor[-1][2] if self.monitor else None
+            if ids == ('next',):
+                if not self.new_image.wait_for(lambda: self.n_monitored > self.n_next, timeout=NEXT_IMAGE_WAIT):
+                    return None
+                for _, _, tif, n in self.monitor:
+                    if n > self.n_next:
+                        self.n_next = n
+                        return tif
+                return None
+            for series, image_id, tif, _ in self.monitor:
+                if [str(series), str(image_id)] == list(ids):
+                    return tif
+            return None
+
+
+def to_hdf5(frames):
+    """
+    frames as /entry/data/data of an in-memory hdf5 file, an empty master file for None
+    """
+    try:
+        import h5py
+    except ImportError:
+        return b'' if frames is None else frames.tobytes()
+    buffer = io.BytesIO()
+    with h5py.File(buffer, 'w') as f:
+        entry = f.create_group('entry')
+        if frames is not None:
+            entry.create_group('data').create_dataset('data', data=frames)
+    return buffer.getvalue()
+
+
+class MockHandler(BaseHTTPRequestHandler):
+    """
+    SIMPLON API requests on the MockDCU of the server, delayed by the latency and bandwidth of their section
+    """
+    protocol_version = 'HTTP/1.1'
+    disable_nagle_algorithm = True
+
+    def log_message(self, format, *args):
+        log.debug(f'{self.address_string()} {format % args}')
+
+    def __respond(self, section, status, body=None):
+        data = b'' if body is None else body if isinstance(body, bytes) else json.dumps(body).encode()
+        delay = self.server.latency.get(section, self.server.latency.get('default', 0))
+        bandwidth = self.server.bandwidth.get(section, self.server.bandwidth.get('default'))
+        if bandwidth:
+            delay += len(data) / bandwidth
+        if delay:
+            sleep(delay)
+        self.send_response(status)
+        content_type = 'application/json' if body is not None and not isinstance(body, bytes) else \
+            'application/tiff' if section == 'images' else 'application/octet-stream'
+        self.send_header('Content-Type', content_type)
+        self.send_header('Content-Length', str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def __parse(self):
+        if self.path.startswith('/data/'):
+            return None, 'data', self.path[6:]
+        match = URL_PATTERN.match(self.path)
+        if match is None:
+            return None, None, None
+        return match.groups()
+
+    def do_GET(self):
+        dcu = self.server.dcu
+        subsystem, section, param = self.__parse()
+        try:
+            if section == 'data':
+                with dcu.lock:
+                    data = dcu.files.get(param)
+                self.__respond(section, 404 if data is None else 200, data)
+            elif section == 'images':
+                if param is None:
+                    self.__respond(section, 200, dcu.image_list())
+                    return
+                data = dcu.image(*param.split('/'))
+                self.__respond(section, 200 if data is not None else 408 if param == 'next' else 404, data)
+            elif section == 'files':
+                with dcu.lock:
+                    self.__respond(section, 200, list(dcu.files))
+            elif section in ('config', 'status'):
+                self.__respond(section, 200, {'value': dcu.get(subsystem, section, param)})
+            else:
+                self.__respond(section, 404)
+        except KeyError:
+            self.__respond(section, 404)
+
+    def do_PUT(self):
+        dcu = self.server.dcu
+        subsystem, section, param = self.__parse()
+        length = int(self.headers.get('Content-Length', 0))
+        body = json.loads(self.rfile.read(length)) if length else {}
+        try:
+            if section == 'config':
+                self.__respond(section, 200, dcu.set(subsystem, param, body['value']))
+            elif section == 'command':
+                self.__respond(section, 200, dcu.command(subsystem, param))
+            else:
+                self.__respond(section, 404)
+        except KeyError:
+            self.__respond(section, 404)
+        except RuntimeError as e:
+            log.warning(f'{self.path}: {e}')
+            self.__respond(section, 400)
+
+
+class MockServer(ThreadingHTTPServer):
+    """
+    http server for a MockDCU; latency in seconds and bandwidth in bytes per second are given per API section
+    ('config', 'status', 'command', 'images', 'files', 'data') with 'default' for the others
+    """
+    daemon_threads = True
+
+    def __init__(self, dcu, address=('localhost', 8080), latency=None, bandwidth=None):
+        super().__init__(address, MockHandler)
+        self.dcu = dcu
+        self.latency = latency or {}
+        self.bandwidth = bandwidth or {}
+
+    def start(self):
+        """
+        serves in a background thread, e.g. for benchmarks
+        """
+        thread = threading.Thread(target=self.serve_forever, daemon=True)
+        thread.start()
+        return thread
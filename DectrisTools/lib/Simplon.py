@@ -0,0 +1,452 @@
+"""
+client for the SIMPLON REST API of the DCU, sharing one pool of keep-alive connections per detector and process
+"""
+import json
+import socket
+import logging as log
+import threading
+import http.client
+from math import isclose
+from time import perf_counter
+from os import path, remove
+from operator import attrgetter
+from queue import LifoQueue, Empty
+from concurrent.futures import ThreadPoolExecutor
+
+SIMPLON_API = '1.8.0'
+# commands like trigger or initialize only return once the detector is done
+COMMAND_TIMEOUT = 300
+# seconds the DCU holds a GET of monitor/images/next before answering 408 if no image arrives; the client waits longer
+# than that, a request is never given up while it can still take an image
+NEXT_IMAGE_WAIT = 5
+# upper limit for the connections opened by one concurrent sweep of requests
+SWEEP_WORKERS = 16
+# bytes read at a time when a response body is streamed to a file, e.g. the HDF5 files of the filewriter
+DOWNLOAD_CHUNK = 2**20
+
+
+class SimplonClient:
+    """
+    thread-safe wrapper around a pool of persistent http.client connections to the DCU
+    """
+    def __init__(self, ip, port, timeout=5):
+        self.ip = ip
+        self.port = port
+        self.timeout = timeout
+        self.pool = LifoQueue()
+        self.lock = threading.Lock()
+        self.n_requests = 0
+        self.n_connections = 0
+
+    def __del__(self):
+        self.close()
+
+    @staticmethod
+    def url(subsystem, section, param=None):
+        if param is None:
+            return f'/{subsystem}/api/{SIMPLON_API}/{section}'
+        return f'/{subsystem}/api/{SIMPLON_API}/{section}/{param}'
+
+    def stats(self):
+        """
+        returns the number of requests sent and connections opened so far
+        """
+        return {'requests': self.n_requests, 'connections': self.n_connections, 'idle_connections': self.pool.qsize()}
+
+    def close(self):
+        while True:
+            try:
+                self.pool.get_nowait().close()
+            except Empty:
+                return
+
+    def __connection(self, timeout):
+        try:
+            connection, reused = self.pool.get_nowait(), True
+        except Empty:
+            connection, reused = http.client.HTTPConnection(self.ip, self.port), False
+            with self.lock:
+                self.n_connections += 1
+        connection.timeout = timeout
+        if connection.sock is not None:
+            connection.sock.settimeout(timeout)
+        return connection, reused
+
+    def request(self, method, url, body=None, timeout=None, stamps=None, in_flight=None, out=None):
+        """
+        send a request to the DCU and return the response status and body; a connection closed by the DCU while
+        idling in the pool is replaced once. the arrival of the response headers and body are recorded in the dict
+        stamps as 'listed' and 'downloaded' if given. the connection is kept in the set in_flight while the request
+        runs, for shutting it down from another thread, which removes it from in_flight so that it is not replaced.
+        with the file out, the body of a successful response is written to it in chunks and None is returned for it
+        """
+        headers = {}
+        if body is not None:
+            body = json.dumps(body)
+            headers['Content-Type'] = 'application/json'
+        with self.lock:
+            self.n_requests += 1
+        while True:
+            connection, reused = self.__connection(timeout or self.timeout)
+            if in_flight is not None:
+                in_flight.add(connection)
+            try:
+                connection.request(method, url, body=body, headers=headers)
+                response = connection.getresponse()
+                if stamps is not None:
+                    stamps['listed'] = perf_counter()
+                if out is not None and response.status == 200:
+                    for chunk in iter(lambda: response.read(DOWNLOAD_CHUNK), b''):
+                        out.write(chunk)
+                    data = None
+                else:
+                    data = response.read()
+                if stamps is not None:
+                    stamps['downloaded'] = perf_counter()
+            except (http.client.RemoteDisconnected, ConnectionResetError, BrokenPipeError):
+                connection.close()
+                if reused and (in_flight is None or connection in in_flight):
+                    continue
+                raise
+            except http.client.HTTPException as e:
+                # a garbled or truncated response is a failed request like any other network error
+                connection.close()
+                raise OSError(f'{method} {url} failed: {e!r}') from e
+            except Exception:
+                connection.close()
+                raise
+            finally:
+                if in_flight is not None:
+                    in_flight.discard(connection)
+            if response.will_close:
+                connection.close()
+            else:
+                self.pool.put(connection)
+            return response.status, data
+
+    def get(self, subsystem, section, param=None, timeout=None):
+        status, data = self.request('GET', self.url(subsystem, section, param), timeout=timeout)
+        if status != 200:
+            raise OSError(f'GET {self.url(subsystem, section, param)} failed with status {status}')
+        data = json.loads(data)
+        if isinstance(data, dict) and 'value' in data:
+            return data['value']
+        return data
+
+    def put(self, subsystem, section, param, value=None, timeout=None):
+        body = None if value is None else {'value': value}
+        status, data = self.request('PUT', self.url(subsystem, section, param), body, timeout=timeout)
+        if status != 200:
+            raise OSError(f'PUT {self.url(subsystem, section, param)} failed with status {status}')
+        return json.loads(data) if data else None
+
+
+class ConfigParameter:
+    """
+    descriptor for a parameter of a SIMPLON subsystem, writable if it is in the config section and not read_only;
+    mirrored parameters are only read from the DCU if they are not in the mirror of the subsystem yet and are written
+    through it
+    """
+    def __init__(self, param=None, section='config', mirrored=False, read_only=False):
+        self.param = param
+        self.section = section
+        self.mirrored = mirrored
+        self.writable = section == 'config' and not read_only
+
+    def __set_name__(self, owner, name):
+        if self.param is None:
+            self.param = name
+
+    def __get__(self, obj, objtype=None):
+        if obj is None:
+            return self
+        if self.mirrored and self.param in obj.mirror:
+            return obj.mirror[self.param]
+        n_writes = obj.n_writes.get(self.param, 0)
+        value = obj.client.get(obj.subsystem, self.section, self.param)
+        if self.mirrored:
+            obj.update_mirror(self.param, value, n_writes)
+        return value
+
+    def __set__(self, obj, value):
+        if not self.writable:
+            raise AttributeError(f'{self.param} is read-only')
+        if self.mirrored:
+            obj.count_write(self.param)
+        changed = obj.client.put(obj.subsystem, 'config', self.param, value)
+        if self.mirrored:
+            with obj.mirror_lock:
+                # the DCU lists the parameters it changed along with this one, those have to be read again
+                for param in changed or []:
+                    obj.mirror.pop(param, None)
+                    obj.count_write(param)
+                obj.mirror[self.param] = value
+                obj.count_write(self.param)
+
+
+class Subsystem:
+    """
+    base class for the detector, monitor, filewriter and stream subsystems of the DCU
+    """
+    subsystem = None
+    state = ConfigParameter(section='status')
+
+    def __init__(self, client):
+        self.client = client
+        self.mirror = {}
+        # writes per mirrored parameter, a value read while the parameter was written must not replace the written one
+        self.n_writes = {}
+        self.mirror_lock = threading.RLock()
+
+    def count_write(self, param):
+        with self.mirror_lock:
+            self.n_writes[param] = self.n_writes.get(param, 0) + 1
+
+    def update_mirror(self, param, value, n_writes):
+        """
+        mirrors value read from the DCU unless param was written since n_writes was taken before reading it, returns
+        the value it was mirrored over or None
+        """
+        with self.mirror_lock:
+            if self.n_writes.get(param, 0) != n_writes:
+                return None
+            mirrored = self.mirror.get(param)
+            self.mirror[param] = value
+            return mirrored
+
+    def refresh(self):
+        """
+        reads all mirrored parameters from the DCU again and returns {param: (mirrored, current)} for the ones that
+        were changed by another client; parameters written while they were read are left as written
+        """
+        changed = {}
+        for attr in vars(type(self)).values():
+            if isinstance(attr, ConfigParameter) and attr.mirrored:
+                n_writes = self.n_writes.get(attr.param, 0)
+                value = self.client.get(self.subsystem, attr.section, attr.param)
+                mirrored = self.update_mirror(attr.param, value, n_writes)
+                if mirrored is not None and differs(value, mirrored):
+                    changed[attr.param] = (mirrored, value)
+        if changed:
+            log.warning(f'{self.subsystem} configuration changed by another client: {changed}')
+        return changed
+
+    def configuration(self):
+        """
+        {param: value} of the writable parameters in the mirror, e.g. for writing them again after the DCU restarted
+        """
+        mirror = dict(self.mirror)
+        return {attr.param: mirror[attr.param] for attr in vars(type(self)).values()
+                if isinstance(attr, ConfigParameter) and attr.writable and attr.param in mirror}
+
+    def command(self, name, timeout=COMMAND_TIMEOUT):
+        return self.client.put(self.subsystem, 'command', name, timeout=timeout)
+
+    def clear(self):
+        self.command('clear')
+
+
+class Monitor(Subsystem):
+    subsystem = 'monitor'
+    mode = ConfigParameter()
+    buffer_size = ConfigParameter()
+
+    def __init__(self, client):
+        super().__init__(client)
+        # connections of the running next_image requests, and the number of times they were interrupted
+        self.in_flight = set()
+        self.n_interrupts = 0
+
+    @property
+    def image_list(self):
+        return self.client.get(self.subsystem, 'images')
+
+    @property
+    def last_image(self):
+        return self.image('monitor')
+
+    def image(self, *ids, stamps=None):
+        """
+        returns an image from the monitor in tif format, either by sequence and image id or 'monitor'/'next'; returns
+        None if the monitor buffer does not hold it (anymore)
+        """
+        url = self.client.url(self.subsystem, 'images', '/'.join(str(i) for i in ids))
+        status, data = self.client.request('GET', url, stamps=stamps)
+        if status == 404:
+            return None
+        if status != 200:
+            raise OSError(f'GET {url} failed with status {status}')
+        return data
+
+    def next_image(self, stamps=None):
+        """
+        blocks until the monitor has the next image and returns it in tif format, returns None if the DCU had none
+        within NEXT_IMAGE_WAIT or the request was interrupted by interrupt_next; other failures raise OSError
+        """
+        n_interrupts = self.n_interrupts
+        try:
+            status, data = self.client.request('GET', self.client.url(self.subsystem, 'images', 'next'),
+                                               timeout=NEXT_IMAGE_WAIT + self.client.timeout, stamps=stamps,
+                                               in_flight=self.in_flight)
+        except OSError:
+            if self.n_interrupts != n_interrupts:
+                return None
+            raise
+        if status == 200:
+            return data
+        if status in (204, 404, 408):
+            return None
+        raise OSError(f'GET {self.client.url(self.subsystem, "images", "next")} failed with status {status}')
+
+    def interrupt_next(self):
+        """
+        shuts down the connections of the running next_image requests, e.g. once the acquisition was aborted and the
+        images it could still take are not wanted anymore
+        """
+        self.n_interrupts += 1
+        for connection in list(self.in_flight):
+            self.in_flight.discard(connection)
+            try:
+                connection.sock.shutdown(socket.SHUT_RDWR)
+            except (AttributeError, OSError):
+                pass
+
+
+class FileWriter(Subsystem):
+    subsystem = 'filewriter'
+    mode = ConfigParameter()
+    nimages_per_file = ConfigParameter()
+    name_pattern = ConfigParameter()
+
+    @property
+    def files(self):
+        return self.client.get(self.subsystem, 'files')
+
+    def save(self, filename, savedir):
+        """
+        downloads filename from the DCU into savedir, streamed to disk instead of held in memory
+        """
+        target = path.join(savedir, filename)
+        with open(target, 'wb') as f:
+            try:
+                status, _ = self.client.request('GET', f'/data/{filename}', timeout=COMMAND_TIMEOUT, out=f)
+                if status != 200:
+                    raise OSError(f'GET /data/{filename} failed with status {status}')
+            except OSError:
+                # no truncated file is left behind
+                f.close()
+                remove(target)
+                raise
+
+
+class StreamInterface(Subsystem):
+    subsystem = 'stream'
+    mode = ConfigParameter()
+
+
+class Detector(Subsystem):
+    """
+    the parts of the detector subsystem used by DectrisTools, with the monitor, filewriter and stream subsystems
+    """
+    subsystem = 'detector'
+    description = ConfigParameter(mirrored=True, read_only=True)
+    count_time = ConfigParameter(mirrored=True)
+    frame_time = ConfigParameter(mirrored=True)
+    trigger_mode = ConfigParameter(mirrored=True)
+    ntrigger = ConfigParameter(mirrored=True)
+    nimages = ConfigParameter(mirrored=True)
+    counting_mode = ConfigParameter(mirrored=True)
+    incident_energy = ConfigParameter(mirrored=True)
+    compression = ConfigParameter(mirrored=True)
+
+    def __init__(self, ip, port):
+        super().__init__(SimplonClient(ip, port))
+        self.mon = Monitor(self.client)
+        self.fw = FileWriter(self.client)
+        self.stream = StreamInterface(self.client)
+
+    def __str__(self):
+        return f'Dectris detector at {self.client.ip} port {self.client.port}'
+
+    def initialize(self):
+        self.command('initialize')
+
+    def arm(self):
+        return self.command('arm')
+
+    def trigger(self):
+        self.command('trigger')
+
+    def disarm(self):
+        self.command('disarm')
+
+    def abort(self):
+        self.command('abort')
+
+
+DETECTORS = {}
+DETECTORS_LOCK = threading.Lock()
+
+
+def get_detector(ip, port):
+    """
+    returns the Detector for ip and port shared by everything in this process
+    """
+    with DETECTORS_LOCK:
+        if (ip, port) not in DETECTORS:
+            DETECTORS[ip, port] = Detector(ip, port)
+        return DETECTORS[ip, port]
+
+
+def sweep(calls):
+    """
+    runs the callables {key: f} concurrently, each on its own pooled connection, and returns {key: f()}; the first
+    exception raised by a call is raised again once all of them are done
+    """
+    with ThreadPoolExecutor(max_workers=min(len(calls), SWEEP_WORKERS) or 1, thread_name_prefix='sweep') as executor:
+        futures = {key: executor.submit(call) for key, call in calls.items()}
+    return {key: future.result() for key, future in futures.items()}
+
+
+def parameter_reads(detector, paths):
+    """
+    returns {path: callable reading it} for attribute paths of detector like 'count_time' or 'mon.mode'
+    """
+    return {path: lambda getter=attrgetter(path): getter(detector) for path in paths}
+
+
+def read_parameters(detector, paths):
+    """
+    reads the attribute paths of detector in one concurrent sweep and returns {path: value}; mirrored parameters fill
+    the mirror on the way
+    """
+    return sweep(parameter_reads(detector, paths))
+
+
+def differs(value, target):
+    """
+    tells if value read from the DCU differs from target, allowing for the rounding of times by the DCU
+    """
+    if isinstance(value, (int, float)) and isinstance(target, (int, float)) and not isinstance(target, bool):
+        return not isclose(value, target, rel_tol=1e-6, abs_tol=1e-9)
+    return value != target
+
+
+def write_profile(detector, profile, current):
+    """
+    writes the values of profile {attribute path: value} that differ from current {attribute path: value}, in the
+    order of profile; parameters the DCU changed along with a written one are read again before they are compared.
+    returns {attribute path: value} of the written ones
+    """
+    written = {}
+    for path, value in profile.items():
+        owner_path, _, name = path.rpartition('.')
+        owner = attrgetter(owner_path)(detector) if owner_path else detector
+        descriptor = getattr(type(owner), name, None)
+        if written and isinstance(descriptor, ConfigParameter) and descriptor.mirrored \
+                and descriptor.param not in owner.mirror:
+            current[path] = getattr(owner, name)
+        if differs(current[path], value):
+            setattr(owner, name, value)
+            current[path] = written[path] = value
+    return written
@@ -0,0 +1,72 @@
+"""
+deterministic stand-in for the detector producing diffraction images at a fixed rate, for working without hardware
+"""
+from time import sleep, perf_counter
+import numpy as np
+
+# upper limit for the memory of the precomputed frames
+BANK_BYTES = 256 * 2**20
+# the frame schedule is reset instead of catching up if it lags behind by more than this many seconds
+MAX_LAG = 0.1
+
+
+def diffraction_pattern(shape, n_rings=6, max_counts=1000, seed=0):
+    """
+    expected counts of a powder diffraction pattern: rings on a diffuse background around an off-center beam stop
+    """
+    rng = np.random.default_rng(seed)
+    height, width = shape
+    y, x = np.ogrid[:height, :width]
+    r = np.hypot(y - 0.52 * height, x - 0.47 * width) / min(shape)
+    intensity = 0.3 / (1 + (r / 0.05)**2) + 0.02
+    for radius, amplitude in zip(np.linspace(0.08, 0.45, n_rings), rng.uniform(0.2, 1, n_rings)):
+        intensity += amplitude * np.exp(-0.5 * ((r - radius) / 0.004)**2)
+    intensity[r < 0.03] = 0
+    return max_counts / intensity.max() * intensity
+
+
+class DetectorSimulator:
+    """
+    cycling through a bank of n_frames Poisson noise realizations of a diffraction pattern, one every 1/rate seconds;
+    the same seed gives the same frames
+    """
+    def __init__(self, rate=10, shape=(512, 512), dtype='uint16', n_frames=32, seed=0):
+        self.rate = rate
+        self.dtype = np.dtype(dtype)
+        max_counts = 100 if self.dtype.itemsize == 1 else 1000
+        pattern = diffraction_pattern(shape, max_counts=max_counts, seed=seed)
+        n_frames = max(1, min(n_frames, BANK_BYTES // (pattern.size * self.dtype.itemsize)))
+        rng = np.random.default_rng(seed)
+        self.bank = np.empty((n_frames, *shape), dtype=self.dtype)
+        for frame in self.bank:
+            counts = rng.poisson(pattern)
+            if self.dtype.kind in 'ui':
+                np.clip(counts, 0, np.iinfo(self.dtype).max, out=counts)
+            frame[:] = counts
+        self.bank.flags.writeable = False
+        self.n_produced = 0
+        self.t_next = None
+
+    def __str__(self):
+        return f'DetectorSimulator {self.bank.shape[2]}x{self.bank.shape[1]} {self.dtype.name} at {self.rate}Hz'
+
+    def start(self):
+        """
+        restarts the frame schedule, e.g. after a pause of the acquisition
+        """
+        self.t_next = None
+
+    def next_frame(self):
+        """
+        waits until the next frame is due and returns it as a read-only view into the frame bank
+        """
+        t = perf_counter()
+        if self.t_next is None or t - self.t_next > MAX_LAG:
+            self.t_next = t
+        if self.rate:
+            self.t_next += 1 / self.rate
+            if self.t_next > t:
+                sleep(self.t_next - t)
+        frame = self.bank[self.n_produced % len(self.bank)]
+        self.n_produced += 1
+        return frame
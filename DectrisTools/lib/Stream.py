@@ -0,0 +1,133 @@
+"""
+receiver for the zmq push stream of the DCU stream interface and a local stand-in publisher for testing without hardware
+"""
+import json
+import logging as log
+import numpy as np
+try:
+    import zmq
+except ImportError:
+    zmq = None
+
+STREAM_PORT = 9999
+
+
+def require_zmq():
+    """
+    raises ImportError if pyzmq is missing, for failing before anything is set up
+    """
+    if zmq is None:
+        raise ImportError('the stream interface requires pyzmq')
+
+
+def stream_address(ip, port, bind=False):
+    if bind:
+        return f'tcp://*:{port}'
+    if ':' in ip:
+        return f'tcp://[{ip}]:{port}'
+    return f'tcp://{ip}:{port}'
+
+
+def decode_stream_image(image_header, data):
+    """
+    data blob of a dimage-1.0 message is returned as a np.ndarray according to its dimage_d-1.0 header
+    """
+    dtype = np.dtype(image_header['type']).newbyteorder('<')
+    width, height = image_header['shape']
+    encoding = image_header['encoding']
+    if encoding == '<':
+        return np.frombuffer(data, dtype=dtype).reshape(height, width)
+    if encoding == 'lz4<':
+        import lz4.block
+        raw = lz4.block.decompress(data, uncompressed_size=width * height * dtype.itemsize)
+        return np.frombuffer(raw, dtype=dtype).reshape(height, width)
+    if encoding.startswith('bs') and encoding.endswith('-lz4<'):
+        import bitshuffle
+        # bitshuffle/lz4 blobs start with the big endian total size (8 bytes) and block size (4 bytes)
+        block_size = int.from_bytes(data[8:12], 'big') // dtype.itemsize
+        return bitshuffle.decompress_lz4(np.frombuffer(data, dtype=np.uint8, offset=12), (height, width), dtype,
+                                         block_size)
+    raise ValueError(f'unsupported stream encoding {encoding}')
+
+
+class StreamReceiver:
+    """
+    pulling images from the stream interface of the DCU
+    """
+    def __init__(self, ip, port=STREAM_PORT):
+        require_zmq()
+        self.context = zmq.Context.instance()
+        self.socket = self.context.socket(zmq.PULL)
+        if ':' in ip:
+            self.socket.setsockopt(zmq.IPV6, 1)
+        try:
+            self.socket.connect(stream_address(ip, port))
+        except zmq.ZMQError as e:
+            self.socket.close(linger=0)
+            raise OSError(f'connecting to {stream_address(ip, port)} failed: {e}') from e
+        self.series = None
+        # number of the last image within its series
+        self.frame = None
+        log.info(f'StreamReceiver connected to {stream_address(ip, port)}')
+
+    def __del__(self):
+        self.close()
+
+    def close(self):
+        if not self.socket.closed:
+            self.socket.close(linger=0)
+
+    def next_frame(self, timeout=0.05, decode=True):
+        """
+        returns the next image in the stream or None if nothing arrived within timeout seconds; without decode the
+        image is returned as (dimage_d header, data)
+        """
+        while self.socket.poll(int(timeout * 1000)):
+            parts = self.socket.recv_multipart(copy=False)
+            header = json.loads(parts[0].bytes)
+            htype = header.get('htype', '')
+            if htype.startswith('dheader'):
+                self.series = header.get('series')
+                log.debug(f'stream: start of series {self.series}')
+            elif htype.startswith('dseries_end'):
+                log.debug(f'stream: end of series {header.get("series")}')
+            elif htype.startswith('dimage-'):
+                self.frame = header.get('frame')
+                if not decode:
+                    return json.loads(parts[1].bytes), parts[2].bytes
+                return decode_stream_image(json.loads(parts[1].bytes), parts[2].buffer)
+        return None
+
+
+class StreamPublisher:
+    """
+    stand-in for the stream interface of the DCU, pushing images in the same message format
+    """
+    def __init__(self, port=STREAM_PORT):
+        require_zmq()
+        self.context = zmq.Context.instance()
+        self.socket = self.context.socket(zmq.PUSH)
+        self.socket.setsockopt(zmq.SNDHWM, 100)
+        self.socket.bind(stream_address(None, port, bind=True))
+        log.info(f'StreamPublisher bound to {stream_address(None, port, bind=True)}')
+
+    def close(self):
+        if not self.socket.closed:
+            self.socket.close(linger=0)
+
+    def send_header(self, series):
+        self.socket.send_json({'htype': 'dheader-1.0', 'series': series, 'header_detail': 'none'})
+
+    def send_image(self, image, series, frame):
+        image = np.ascontiguousarray(image, dtype=image.dtype.newbyteorder('<'))
+        height, width = image.shape
+        self.socket.send_multipart([
+            json.dumps({'htype': 'dimage-1.0', 'series': series, 'frame': frame, 'hash': ''}).encode(),
+            json.dumps({'htype': 'dimage_d-1.0', 'shape': [width, height], 'type': image.dtype.name,
+                        'encoding': '<', 'size': image.nbytes}).encode(),
+            image,
+            json.dumps({'htype': 'dconfig-1.0', 'start_time': 0, 'stop_time': 0, 'real_time': 0}).encode()
+        ], copy=False)
+
+    def send_end(self, series):
+        self.socket.send_json({'htype': 'dseries_end-1.0', 'series': series})
@@ -0,0 +1,132 @@
+"""
+decoding of the uncompressed tif images served by the DCU monitor without going through PIL
+"""
+import io
+import struct
+import numpy as np
+
+# tif field types that can hold the tags we need
+FIELD_FORMATS = {1: 'B', 3: 'H', 4: 'I', 16: 'Q'}
+# (bits per sample, sample format) -> dtype character
+SAMPLE_DTYPES = {(8, 1): 'u1', (16, 1): 'u2', (32, 1): 'u4', (8, 2): 'i1', (16, 2): 'i2', (32, 2): 'i4',
+                 (32, 3): 'f4', (64, 3): 'f8'}
+
+
+def read_ifd(data):
+    """
+    returns the byte order and the raw entries of the first IFD of a classic tif file
+    """
+    byteorder = {b'II': '<', b'MM': '>'}[bytes(data[:2])]
+    magic, ifd_offset = struct.unpack_from(f'{byteorder}HI', data, 2)
+    if magic != 42:
+        raise ValueError('not a classic tif file')
+    n_entries, = struct.unpack_from(f'{byteorder}H', data, ifd_offset)
+    return byteorder, bytes(data[ifd_offset + 2:ifd_offset + 2 + 12 * n_entries])
+
+
+def read_tags(data):
+    """
+    returns the byte order and the tags of the first IFD of a classic tif file as {tag: tuple of values}
+    """
+    byteorder, ifd = read_ifd(data)
+    tags = {}
+    for tag, field_type, count, value in struct.iter_unpack(f'{byteorder}HHI4s', ifd):
+        if field_type not in FIELD_FORMATS:
+            continue
+        fmt = f'{byteorder}{count}{FIELD_FORMATS[field_type]}'
+        if struct.calcsize(fmt) <= 4:
+            tags[tag] = struct.unpack_from(fmt, value)
+        else:
+            tags[tag] = struct.unpack_from(fmt, data, struct.unpack(f'{byteorder}I', value)[0])
+    return byteorder, tags
+
+
+def external_strips(data, byteorder, ifd):
+    """
+    returns (offset, raw bytes) of the strip offsets and byte counts too long to be stored in the IFD entries
+    """
+    strips = []
+    for tag, field_type, count, value in struct.iter_unpack(f'{byteorder}HHI4s', ifd):
+        if tag in (273, 279) and field_type in FIELD_FORMATS:
+            size = count * struct.calcsize(FIELD_FORMATS[field_type])
+            if size > 4:
+                offset, = struct.unpack(f'{byteorder}I', value)
+                strips.append((offset, bytes(data[offset:offset + size])))
+    return tuple(strips)
+
+
+def parse_layout(data):
+    """
+    returns (offset, dtype, shape) of the pixel data if it can be viewed directly, None otherwise
+    """
+    byteorder, tags = read_tags(data)
+    compression = tags.get(259, (1,))[0]
+    samples_per_pixel = tags.get(277, (1,))[0]
+    if compression != 1 or samples_per_pixel != 1:
+        return None
+    width, height = tags[256][0], tags[257][0]
+    key = (tags.get(258, (1,))[0], tags.get(339, (1,))[0])
+    if key not in SAMPLE_DTYPES:
+        return None
+    dtype = np.dtype(byteorder + SAMPLE_DTYPES[key])
+    offsets, byte_counts = tags[273], tags[279]
+    # strips have to follow each other without gaps to be viewed as one array
+    for offset, byte_count, next_offset in zip(offsets, byte_counts, offsets[1:]):
+        if offset + byte_count != next_offset:
+            return None
+    if sum(byte_counts) < width * height * dtype.itemsize:
+        return None
+    return offsets[0], dtype, (height, width)
+
+
+class TiffDecoder:
+    """
+    decoder caching the layout of the tif files it has seen, keyed by the raw IFD entries holding the geometry, sample
+    type and strips; strip offsets and byte counts stored outside of the IFD are compared on every hit
+    """
+    def __init__(self):
+        self.layouts = {}
+
+    def layout(self, data):
+        """
+        returns the cached (offset, dtype, shape) of the pixel data or None if it cannot be viewed directly
+        """
+        key = read_ifd(data)
+        cached = self.layouts.get(key)
+        if cached is not None:
+            layout, strips = cached
+            if all(data[offset:offset + len(raw)] == raw for offset, raw in strips):
+                return layout
+        layout = parse_layout(data)
+        self.layouts[key] = layout, external_strips(data, *key)
+        return layout
+
+    def decode(self, data):
+        """
+        returns the image as a read-only np.ndarray view into data
+        """
+        layout = self.layout(data)
+        if layout is None:
+            from PIL import Image
+            return np.array(Image.open(io.BytesIO(data)))
+        offset, dtype, shape = layout
+        return np.frombuffer(data, dtype=dtype, count=shape[0] * shape[1], offset=offset).reshape(shape)
+
+
+def encode_tiff(image):
+    """
+    np.ndarray is returned as an uncompressed single strip tif file like the ones from the DCU monitor
+    """
+    image = np.ascontiguousarray(image, dtype=image.dtype.newbyteorder('<'))
+    height, width = image.shape
+    sample_format = {'u': 1, 'i': 2, 'f': 3}[image.dtype.kind]
+    # 10 IFD entries, data starts 16 byte aligned after the IFD
+    data_offset = 144
+    entries = [(256, 4, width), (257, 4, height), (258, 3, image.dtype.itemsize * 8), (259, 3, 1), (262, 3, 1),
+               (273, 4, data_offset), (277, 3, 1), (278, 4, height), (279, 4, image.nbytes), (339, 3, sample_format)]
+    header = b'II' + struct.pack('<HI', 42, 8) + struct.pack('<H', len(entries))
+    for tag, field_type, value in entries:
+        value = struct.pack('<H2x', value) if field_type == 3 else struct.pack('<I', value)
+        header += struct.pack('<HHI', tag, field_type, 1) + value
+    header += struct.pack('<I', 0)
+    return header.ljust(data_offset, b'\0') + image.tobytes()
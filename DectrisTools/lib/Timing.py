@@ -0,0 +1,166 @@
+"""
+helpers for keeping track of timings in the acquisition and display pipeline
+"""
+import threading
+from time import perf_counter
+from collections import deque, OrderedDict
+from contextlib import contextmanager
+import numpy as np
+
+
+class RollingStats:
+    """
+    rolling window of timings in seconds
+    """
+    def __init__(self, maxlen=100):
+        self.values = deque(maxlen=maxlen)
+
+    def __len__(self):
+        return len(self.values)
+
+    def __str__(self):
+        if not self.values:
+            return 'no data'
+        summary = self.summary()
+        return f'{summary["mean"] * 1e3:.1f}ms (median {summary["median"] * 1e3:.1f}ms, ' \
+               f'max {summary["max"] * 1e3:.1f}ms, n={summary["n"]})'
+
+    def add(self, value):
+        self.values.append(value)
+
+    def summary(self):
+        values = np.fromiter(self.values, dtype=float)
+        if values.size == 0:
+            return {'n': 0, 'mean': np.nan, 'median': np.nan, 'p90': np.nan, 'max': np.nan}
+        return {'n': values.size, 'mean': values.mean(), 'median': np.median(values),
+                'p90': np.percentile(values, 90), 'max': values.max()}
+
+
+class StageStats:
+    """
+    busy time of the stages of a pipeline, for reporting their utilization
+    """
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.busy_time = {}
+        self.t_start = perf_counter()
+
+    def reset(self):
+        with self.lock:
+            self.busy_time = {}
+            self.t_start = perf_counter()
+
+    @contextmanager
+    def busy(self, stage):
+        t0 = perf_counter()
+        try:
+            yield
+        finally:
+            with self.lock:
+                self.busy_time[stage] = self.busy_time.get(stage, 0) + perf_counter() - t0
+
+    def utilization(self):
+        """
+        returns the fraction of time since the last reset each stage was busy
+        """
+        elapsed = perf_counter() - self.t_start
+        with self.lock:
+            return {stage: busy / elapsed for stage, busy in self.busy_time.items()}
+
+    def __str__(self):
+        return ', '.join(f'{stage} {u:.0%}' for stage, u in self.utilization().items())
+
+
+class LatencyTracer:
+    """
+    timestamps of every frame from arming the detector until it is painted, keyed by the sequence number of the frame
+    in the FrameRingBuffer; each stage keeps a rolling statistic of the time since the previous stage of its frame
+    """
+    STAGES = ('arm', 'trigger', 'exposure_end', 'listed', 'downloaded', 'decoded', 'handed', 'painted')
+
+    def __init__(self, maxlen=1000):
+        self.maxlen = maxlen
+        self.lock = threading.Lock()
+        self.traces = OrderedDict()
+        self.stages = {stage: RollingStats(maxlen) for stage in self.STAGES[1:] + ('total',)}
+
+    def record(self, seq, stamps):
+        """
+        starts the trace of frame seq with the stamps {stage: perf_counter()} taken before it had a sequence number
+        """
+        with self.lock:
+            self.traces[seq] = {}
+            while len(self.traces) > self.maxlen:
+                self.traces.popitem(last=False)
+        for stage in self.STAGES:
+            if stage in stamps:
+                self.stamp(seq, stage, stamps[stage])
+
+    def stamp(self, seq, stage, t=None):
+        """
+        records the time of stage for frame seq unless it was recorded already, e.g. by an earlier repaint
+        """
+        t = perf_counter() if t is None else t
+        with self.lock:
+            trace = self.traces.get(seq)
+            if trace is None or stage in trace:
+                return
+            if trace:
+                previous = max(trace.values())
+                self.stages[stage].add(t - previous)
+                if stage == self.STAGES[-1]:
+                    self.stages['total'].add(t - min(trace.values()))
+            trace[stage] = t
+
+    def histograms(self, bins=50):
+        """
+        returns {stage: (counts, bin edges in ms)} of the rolling latencies
+        """
+        with self.lock:
+            values = {stage: np.fromiter(stats.values, dtype=float) * 1e3 for stage, stats in self.stages.items()}
+        return {stage: np.histogram(v, bins=bins) for stage, v in values.items() if v.size}
+
+    def summary(self):
+        with self.lock:
+            return {stage: stats.summary() for stage, stats in self.stages.items() if len(stats)}
+
+    def __str__(self):
+        return ', '.join(f'{stage} {s["median"] * 1e3:.1f}ms' for stage, s in self.summary().items())
+
+    def dump(self, filename):
+        """
+        writes the traces as csv, one frame per line with the times of its stages in seconds relative to its first one
+        """
+        with self.lock:
+            traces = list(self.traces.items())
+        with open(filename, 'w') as f:
+            f.write(','.join(('seq',) + self.STAGES) + '\n')
+            for seq, trace in traces:
+                t0 = min(trace.values(), default=0)
+                f.write(','.join([str(seq)] + [f'{trace[s] - t0:.6f}' if s in trace else '' for s in self.STAGES])
+                        + '\n')
+
+
+class StartupTimer:
+    """
+    times since t0 at which the milestones of an application startup were first reached, e.g. the first frame
+    """
+    def __init__(self, t0=None):
+        self.t0 = perf_counter() if t0 is None else t0
+        self.milestones = OrderedDict()
+
+    def mark(self, milestone, t=None):
+        """
+        records the time of milestone, returns False if it was reached before
+        """
+        if milestone in self.milestones:
+            return False
+        self.milestones[milestone] = (perf_counter() if t is None else t) - self.t0
+        return True
+
+    def __str__(self):
+        steps, t_previous = [], 0
+        for milestone, t in sorted(self.milestones.items(), key=lambda item: item[1]):
+            steps.append(f'{milestone} {t * 1e3:.0f}ms (+{(t - t_previous) * 1e3:.0f}ms)')
+            t_previous = t
+        return ', '.join(steps)
@@ -1,67 +1,268 @@
 """
 collection of helper classes and functions
 """
-from time import sleep
+from time import sleep, perf_counter
 import logging as log
-import io
+import threading
+from queue import Queue, Empty, Full
 from collections import deque
-from PyQt5.QtCore import pyqtSignal, pyqtSlot, QObject, QThread
+from concurrent.futures import ThreadPoolExecutor
+from operator import attrgetter
+from PyQt5.QtCore import pyqtSignal, pyqtSlot, QObject, QThread, QTimer
 from PyQt5.QtWidgets import QAction, QMenu
 import numpy as np
 import pyqtgraph as pg
-from PIL import Image
-from uedinst.dectris import Quadro
+from .Simplon import get_detector, ConfigParameter, sweep, parameter_reads, read_parameters, write_profile
+from .Stream import StreamReceiver, STREAM_PORT, decode_stream_image, require_zmq
+from .Tiff import TiffDecoder
+from .Timing import RollingStats, StageStats, LatencyTracer
+from .Buffers import FrameRingBuffer
+from .DecodePool import DecodePool
+from .Simulator import DetectorSimulator
+
+SERIES_LENGTH = 100000
+# seconds between checks for an interruption while handing on triggers and images between threads
+IMAGE_TIMEOUT = 0.5
+# polling of the detector state backs off from STATE_POLL_MIN to STATE_POLL_MAX seconds
+STATE_POLL_MIN = 0.001
+STATE_POLL_MAX = 0.05
+# number of frames kept between acquisition and display
+FRAME_BUFFER_SIZE = 16
+# number of exposures the trigger stage of a pipelined series may run ahead of the readout
+PIPELINE_DEPTH = 2
+# monitor buffer size when draining it; the monitor drops its oldest images once full and is never cleared while
+# draining, so the buffer only has to hold the images arriving while the drain stalls (0.64s at 100Hz)
+MONITOR_BUFFER_SIZE = 64
+# seconds a cancelled acquisition is waited for before going on anyway
+CANCEL_TIMEOUT = 5
+TIFF_DECODER = TiffDecoder()
+# detector attributes read by DectrisStatusGrabber, all at once; configuration parameters come from the mirror
+STATUS_READS = {'quadro': attrgetter('state'), 'fw': attrgetter('fw.state'), 'mon': attrgetter('mon.state'),
+                'trigger_mode': attrgetter('trigger_mode'), 'exposure': attrgetter('frame_time'),
+                'counting_mode': attrgetter('counting_mode')}
+# seconds between re-reads of the mirrored detector configuration
+CONFIG_REFRESH_INTERVAL = 5
+# seconds between reconnection attempts after the link to the detector was lost, doubling up to RECONNECT_MAX
+RECONNECT_MIN = 0.5
+RECONNECT_MAX = 30
+# seconds between checks for an interruption while waiting for the setup or the link
+LINK_POLL = 0.1
+
+
+def put_interruptible(queue, item, stop):
+    """
+    puts item into a bounded queue unless stop is set while waiting; returns False if stopped
+    """
+    while not stop.is_set():
+        try:
+            queue.put(item, timeout=IMAGE_TIMEOUT)
+            return True
+        except Full:
+            pass
+    return False
 
 
 def monitor_to_array(bytestring):
     """
-    image comes as a file-like object in tif format and is returned as a np.ndarray
+    image comes in tif format and is returned as a read-only np.ndarray view into bytestring, in the orientation of
+    the detector; the display orientation is handled by ImageViewWidget
     """
-    return np.rot90(np.array(Image.open(io.BytesIO(bytestring))), k=3)
+    return TIFF_DECODER.decode(bytestring)
 
 
 class DectrisImageGrabber(QObject):
     """
-    class capable of setting the collecting images from the detector in a non-blocking fashion
+    class capable of setting the collecting images from the detector in a non-blocking fashion; images are handed
+    on through the FrameRingBuffer frames
     """
-    image_ready = pyqtSignal(np.ndarray)
+    frame_ready = pyqtSignal(int)
     exposure_triggered = pyqtSignal()
+    # seconds from requesting the cancellation until the acquisition stopped
+    acquisition_cancelled = pyqtSignal(float)
+    # {param: value} written by configure, (param, error) if writing failed
+    config_applied = pyqtSignal(dict)
+    config_failed = pyqtSignal(str, str)
+    # emitted with connected once the detector, stream or simulator is ready for taking images
+    setup_finished = pyqtSignal(bool)
     connected = False
 
-    def __init__(self, ip, port, trigger_mode='ints', exposure=0.3):
+    def __init__(self, ip, port, trigger_mode='ints', exposure=0.3, continuous=True, pipelined=False,
+                 source='monitor', stream_port=STREAM_PORT, decode_workers=0, simulation=None, drain=False):
         super().__init__()
 
-        self.Q = Quadro(ip, port)
+        self.continuous = continuous
+        self.pipelined = pipelined
+        self.stages = StageStats()
+        self.source = source
+        self.receiver = None
+        self.stream_address = (ip, stream_port)
+        if self.source == 'stream':
+            require_zmq()
+        self.frames = FrameRingBuffer(FRAME_BUFFER_SIZE)
+        # decoding in worker processes instead of this thread if decode_workers > 0, started by the setup
+        self.decode_workers = decode_workers
+        self.decode_pool = None
+        # time from the end of an exposure until its image is fetched
+        self.image_latency = RollingStats()
+        # timestamps of the frame being acquired, handed to the tracer along with its sequence number
+        self.stamps = {}
+        self.tracer = LatencyTracer()
+        # rolling durations of the state transitions waited for in wait_for_state
+        self.transition_times = {}
+        # with drain, every image in the monitor buffer is fetched by its (series, image id) instead of images/next
+        self.drain = drain
+        self.drain_queue = deque()
+        self.last_image_id = (0, 0)
+        self.n_lost = 0
+        self.t_listed = None
+        # number of the frame being acquired within its series if the source tells, images per trigger of the series
+        self.frame_number = None
+        self.nimages = 1
+        self.external = False
+
+        self.Q = get_detector(ip, port)
+        # what the hardware has to look like for taking images, in the order it is written
+        self.profile = {'fw.mode': 'disabled'}
+        if self.source == 'stream':
+            self.profile.update({'mon.mode': 'disabled', 'compression': 'lz4', 'stream.mode': 'enabled'})
+        else:
+            self.profile['mon.mode'] = 'enabled'
+            if self.drain:
+                self.profile['mon.buffer_size'] = MONITOR_BUFFER_SIZE
+        self.profile.update({'incident_energy': 1e5, 'count_time': exposure, 'frame_time': exposure,
+                             'trigger_mode': trigger_mode, 'ntrigger': 1})
+        self.setup_time = None
+        # images for @home use if neither the detector nor a stream are available, simulation holds the keyword
+        # arguments of the DetectorSimulator
+        self.simulation = {'rate': 1 / exposure, **(simulation or {})}
+        self.simulator = None
+        # connecting and setting up happen in the command thread, requested by setup or the first acquisition
+        self.setup_requested = False
+        self.ready = threading.Event()
+        # cleared while the LinkSupervisor restores a lost link, the acquisition waits for it
+        self.link = threading.Event()
+        self.link.set()
+
+        self.image_grabber_thread = QThread()
+        self.moveToThread(self.image_grabber_thread)
+        self.image_grabber_thread.started.connect(self.__get_image)
+
+        # cancelling and configuring run in their own thread, the callers never wait for the detector
+        self.idle = threading.Event()
+        self.idle.set()
+        self.pending_config = {}
+        self.pending_lock = threading.Lock()
+        self.config_lock = threading.Lock()
+        self.commands = Queue()
+        self.command_thread = threading.Thread(target=self.__run_commands, daemon=True)
+        self.command_thread.start()
+
+    def setup(self):
+        """
+        requests connecting to and setting up the detector in the background, setup_finished tells when it is done
+        """
+        with self.pending_lock:
+            if self.setup_requested:
+                return
+            self.setup_requested = True
+        self.commands.put(('setup', perf_counter()))
+
+    def __setup(self):
+        if self.decode_workers:
+            self.decode_pool = DecodePool(self.push, self.decode_workers)
+        if self.source == 'stream':
+            try:
+                self.receiver = StreamReceiver(*self.stream_address)
+            except OSError as e:
+                log.error(f'DectrisImageGrabber could not connect to the stream: {e}')
         try:
-            _ = self.Q.state
+            self.setup_time = self.__setup_hardware()
             self.connected = True
             log.info(f'DectrisImageGrabber successfully connected to detector\n{self.Q}')
         except OSError:
             log.warning('DectrisImageGrabber could not establish connection to detector')
+        if not self.connected and self.receiver is None:
+            self.simulator = DetectorSimulator(**self.simulation)
+            log.info(f'using {self.simulator}')
+        self.ready.set()
+        self.setup_finished.emit(self.connected)
 
-        # prepare the hardware for taking images
+    def suspend(self):
+        """
+        the link to the detector was lost: the running acquisition stops, the next one waits for restore and the
+        mirrored configuration is kept in the profile to be written again
+        """
         if self.connected:
-            if self.Q.state == 'na':
-                log.warning('Detector needs to be initialized, that may take a while...')
-                self.Q.initialize()
-            self.Q.mon.clear()
-            self.Q.fw.clear()
-            self.Q.fw.mode = 'disabled'
-            self.Q.mon.mode = 'enabled'
-            self.Q.incident_energy = 1e5
-            self.Q.count_time = exposure
-            self.Q.frame_time = exposure
-            self.Q.trigger_mode = trigger_mode
-            self.Q.ntrigger = 1
+            self.link.clear()
+            # a restarted DCU is not armed anymore, images/next could wait on it forever
+            self.Q.mon.interrupt_next()
+            self.profile.update(self.Q.configuration())
 
-        self.image_grabber_thread = QThread()
-        self.moveToThread(self.image_grabber_thread)
-        self.image_grabber_thread.started.connect(self.__get_image)
+    def restore(self):
+        """
+        sets the detector up again from the profile once it is reachable and lets the acquisition arm again, raises
+        OSError if it is not; also connects a grabber that fell back to the simulator or stream at startup
+        """
+        # the acquisition running when the link was lost ends by itself, see acquiring
+        if self.connected and not self.idle.wait(CANCEL_TIMEOUT):
+            raise OSError('the acquisition did not stop after the link was lost')
+        with self.config_lock:
+            # the DCU may have restarted, nothing mirrored before can be trusted
+            self.Q.mirror.clear()
+            # a series still armed from before the link was lost is ended
+            self.Q.abort()
+            self.setup_time = self.__setup_hardware()
+        # series ids start over after a restart
+        self.reset_drain()
+        if not self.connected:
+            log.info(f'DectrisImageGrabber successfully connected to detector\n{self.Q}')
+        self.connected = True
+        self.link.set()
+
+    def acquiring(self):
+        """
+        tells if the running acquisition goes on: it was not interrupted and the link to the detector is up
+        """
+        return self.link.is_set() and not self.image_grabber_thread.isInterruptionRequested()
+
+    def wait_for(self, event):
+        """
+        blocks until event is set, e.g. ready once the setup finished or link once a lost link is restored; returns
+        False if the thread is interrupted meanwhile
+        """
+        while not event.wait(LINK_POLL):
+            if self.image_grabber_thread.isInterruptionRequested():
+                return False
+        return True
+
+    def __setup_hardware(self):
+        """
+        prepares the hardware for taking images: the current configuration is read and the buffers are cleared in one
+        concurrent sweep, then only the values differing from the profile are written; returns the time it took
+        """
+        t0 = perf_counter()
+        reads = [*self.profile, 'state', 'counting_mode', 'nimages']
+        clears = {'mon.clear': self.Q.mon.clear, 'fw.clear': self.Q.fw.clear}
+        current = sweep({**parameter_reads(self.Q, reads), **clears})
+        if current['state'] == 'na':
+            log.warning('Detector needs to be initialized, that may take a while...')
+            self.Q.initialize()
+            self.Q.mirror.clear()
+            current = read_parameters(self.Q, reads)
+        written = write_profile(self.Q, self.profile, current)
+        setup_time = perf_counter() - t0
+        log.info(f'detector set up in {setup_time * 1000:.0f}ms, wrote {written or "nothing"}')
+        return setup_time
 
     def __del__(self):
+        self.commands.put(None)
         if self.connected:
             self.Q.mon.clear()
             self.Q.abort()
+        if self.receiver is not None:
+            self.receiver.close()
+        if self.decode_pool is not None:
+            self.decode_pool.close()
 
     @pyqtSlot()
     def __get_image(self):
@@ -69,56 +270,420 @@ class DectrisImageGrabber(QObject):
         image collection method
         """
         log.debug(f'started image_grabber_thread {self.image_grabber_thread.currentThread()}')
-        if self.connected:
-            self.Q.arm()
-            # logic for different trigger modes
-            if self.Q.trigger_mode == 'ints':
+        self.setup()
+        if not self.wait_for(self.ready) or not self.wait_for(self.link):
+            self.image_grabber_thread.quit()
+            return
+        self.idle.clear()
+        try:
+            self.__apply_config()
+            if self.connected:
+                trigger_mode = self.Q.trigger_mode
+                if self.continuous and trigger_mode == 'ints':
+                    self.__get_series()
+                elif self.continuous and trigger_mode in ('exts', 'exte'):
+                    self.__get_external_series()
+                else:
+                    self.__get_single_image()
+            elif self.receiver is not None:
+                # stream without detector control, e.g. from the stand-in publisher, until a detector is connected
+                while not self.image_grabber_thread.isInterruptionRequested() and not self.connected:
+                    image = self.next_frame()
+                    if image is not None:
+                        self.publish(image)
+            else:
+                self.__get_simulated_images()
+        except OSError as e:
+            # requests still running when the acquisition is aborted fail
+            if self.image_grabber_thread.isInterruptionRequested():
+                log.debug(f'acquisition aborted: {e}')
+            else:
+                log.error(f'acquisition failed: {e}')
+        finally:
+            self.idle.set()
+
+        self.image_grabber_thread.quit()
+        log.debug(f'quit image_grabber_thread {self.image_grabber_thread.currentThread()}')
+
+    def __get_simulated_images(self):
+        """
+        publish images of the simulator at its rate, only one if not continuous; stops once a detector is connected
+        """
+        self.simulator.start()
+        while not self.image_grabber_thread.isInterruptionRequested() and not self.connected:
+            self.exposure_triggered.emit()
+            with self.stages.busy('readout'):
+                self.stamps['trigger'] = perf_counter()
+                image = self.simulator.next_frame()
+                self.stamps['exposure_end'] = perf_counter()
+                self.publish(image)
+            if not self.continuous:
+                return
+
+    def __get_single_image(self):
+        """
+        arm, trigger and disarm the detector for a single image
+        """
+        self.set_ntrigger(1)
+        self.Q.arm()
+        self.stamps['arm'] = perf_counter()
+        # logic for different trigger modes
+        if self.Q.trigger_mode == 'ints':
+            self.exposure_triggered.emit()
+            self.wait_for_state('idle')
+            self.stamps['trigger'] = perf_counter()
+            self.Q.trigger()
+            self.wait_for_state('idle', False)
+            self.stamps['exposure_end'] = perf_counter()
+            self.Q.disarm()
+        if self.Q.trigger_mode in ('exts', 'exte'):
+            self.wait_for_state('ready')
+            self.exposure_triggered.emit()
+            self.stamps['trigger'] = perf_counter()
+            self.wait_for_state('acquire')
+            self.stamps['exposure_end'] = perf_counter()
+        image = self.next_frame()
+        if image is not None:
+            self.publish(image)
+
+    def __get_series(self):
+        """
+        arm once for a long series of internal triggers and collect the images back-to-back until interrupted
+        """
+        self.set_ntrigger(SERIES_LENGTH)
+        self.nimages = self.Q.nimages
+        self.Q.arm()
+        self.stamps['arm'] = perf_counter()
+        log.debug(f'armed detector for a series of {SERIES_LENGTH} images')
+        self.stages.reset()
+        if self.pipelined:
+            completed = self.__get_pipelined_series()
+        else:
+            completed = self.__get_serial_series()
+        log.info(f'stage utilization: {self.stages}')
+        if completed:
+            self.Q.disarm()
+
+    def __get_external_series(self):
+        """
+        arm once for a long series of external triggers, one exposure per trigger (exts) or gated by the trigger
+        (exte), and publish every image as it arrives until interrupted; the monitor is drained so that the image ids
+        give the trigger index of every frame
+        """
+        self.set_ntrigger(SERIES_LENGTH)
+        self.nimages = self.Q.nimages if self.Q.trigger_mode == 'exts' else 1
+        if self.source == 'monitor' and not self.drain:
+            self.Q.mon.buffer_size = MONITOR_BUFFER_SIZE
+        self.Q.arm()
+        self.stamps['arm'] = perf_counter()
+        log.debug(f'armed detector for a series of {SERIES_LENGTH} external triggers')
+        self.stages.reset()
+        self.external = True
+        try:
+            while not self.image_grabber_thread.isInterruptionRequested():
                 self.exposure_triggered.emit()
-                self.wait_for_state('idle')
+                with self.stages.busy('readout'):
+                    image = self.next_frame()
+                    if image is None:
+                        break
+                    self.publish(image)
+        finally:
+            self.external = False
+            log.info(f'stage utilization: {self.stages}, {self.n_lost} images lost')
+            self.Q.disarm()
+
+    def __get_serial_series(self):
+        """
+        trigger, fetch and publish one image after the other; returns True if the series was completed
+        """
+        for _ in range(SERIES_LENGTH):
+            if self.image_grabber_thread.isInterruptionRequested():
+                return False
+            self.exposure_triggered.emit()
+            with self.stages.busy('trigger'):
+                self.stamps['trigger'] = perf_counter()
                 self.Q.trigger()
-                self.wait_for_state('idle', False)
-                self.Q.disarm()
-            if self.Q.trigger_mode == 'exts':
-                self.wait_for_state('ready')
-                self.exposure_triggered.emit()
-                self.wait_for_state('acquire')
-            # wait until images appears in monitor
-            while not self.Q.mon.image_list:
-                if self.image_grabber_thread.isInterruptionRequested():
-                    self.image_grabber_thread.quit()
+            self.stamps['exposure_end'] = perf_counter()
+            with self.stages.busy('readout'):
+                image = self.next_frame()
+                if image is None:
+                    return False
+                self.publish(image)
+        return True
+
+    def __get_pipelined_series(self):
+        """
+        triggering runs in its own thread, up to PIPELINE_DEPTH exposures ahead of fetching and publishing the images
+        in this one; returns True if the series was completed
+        """
+        triggered = Queue(maxsize=PIPELINE_DEPTH)
+        stop = threading.Event()
+        trigger_thread = threading.Thread(target=self.__trigger_series, args=(triggered, stop), daemon=True)
+        trigger_thread.start()
+        try:
+            while not self.image_grabber_thread.isInterruptionRequested():
+                try:
+                    trigger_times = triggered.get(timeout=IMAGE_TIMEOUT)
+                except Empty:
+                    if not trigger_thread.is_alive():
+                        return False
+                    continue
+                if trigger_times is None:
+                    return True
+                if trigger_times is False:
+                    return False
+                self.stamps['trigger'], self.stamps['exposure_end'] = trigger_times
+                with self.stages.busy('readout'):
+                    image = self.next_frame()
+                    if image is None:
+                        return False
+                    self.publish(image)
+            return False
+        finally:
+            stop.set()
+            trigger_thread.join()
+
+    def __trigger_series(self, triggered, stop):
+        """
+        trigger stage of a pipelined series, queueing the start and end time of every exposure, None at the end of the
+        series and False if triggering failed
+        """
+        for _ in range(SERIES_LENGTH):
+            if stop.is_set():
+                return
+            self.exposure_triggered.emit()
+            with self.stages.busy('trigger'):
+                t_trigger = perf_counter()
+                try:
+                    self.Q.trigger()
+                except OSError as e:
+                    # the running trigger command fails when the acquisition is aborted
+                    if not stop.is_set() and not self.image_grabber_thread.isInterruptionRequested():
+                        log.error(f'triggering failed: {e}')
+                    put_interruptible(triggered, False, stop)
                     return
-                sleep(0.05)
-            self.image_ready.emit(monitor_to_array(self.Q.mon.last_image))
-            self.Q.mon.clear()
+            if not put_interruptible(triggered, (t_trigger, perf_counter()), stop):
+                return
+        put_interruptible(triggered, None, stop)
+
+    def cancel(self):
+        """
+        stops the acquisition without waiting for it: the detector is aborted in the command thread, which emits
+        acquisition_cancelled once the acquisition stopped or after CANCEL_TIMEOUT
+        """
+        self.image_grabber_thread.requestInterruption()
+        self.commands.put(('cancel', perf_counter()))
+
+    def configure(self, **params):
+        """
+        queues writing detector parameters, a value replaces the one queued earlier for the same parameter if that was
+        not written yet; they are written by the command thread if no acquisition runs, otherwise before the next
+        acquisition starts, and reported by config_applied/config_failed
+        """
+        with self.pending_lock:
+            self.pending_config.update(params)
+        self.commands.put(('configure',))
+
+    def __apply_config(self):
+        with self.config_lock:
+            with self.pending_lock:
+                pending, self.pending_config = self.pending_config, {}
+            if not pending:
+                return
+            applied = {}
+            for param, value in pending.items():
+                if not isinstance(getattr(type(self.Q), param, None), ConfigParameter):
+                    self.config_failed.emit(param, 'not a detector parameter')
+                    continue
+                try:
+                    setattr(self.Q, param, value)
+                    applied[param] = value
+                except OSError as e:
+                    log.warning(f'could not set {param} to {value}: {e}')
+                    self.config_failed.emit(param, str(e))
+            if applied:
+                log.debug(f'detector configured: {applied}')
+                self.config_applied.emit(applied)
+
+    def __run_commands(self):
+        while True:
+            command = self.commands.get()
+            if command is None:
+                return
+            if command[0] == 'setup':
+                self.__setup()
+                continue
+            if command[0] == 'configure':
+                if self.idle.is_set():
+                    self.__apply_config()
+                continue
+            _, t_requested = command
+            if self.connected and not self.idle.is_set():
+                try:
+                    self.Q.abort()
+                except OSError as e:
+                    log.warning(f'aborting acquisition failed: {e}')
+                # the images a waiting images/next could still take belong to the aborted series
+                self.Q.mon.interrupt_next()
+            if not self.idle.wait(CANCEL_TIMEOUT):
+                log.warning(f'acquisition did not stop within {CANCEL_TIMEOUT}s')
+            if self.connected:
+                try:
+                    self.Q.mon.clear()
+                    self.reset_drain()
+                except OSError as e:
+                    log.warning(f'clearing the monitor failed: {e}')
+            stall = perf_counter() - t_requested
+            log.debug(f'acquisition cancelled after {stall * 1e3:.1f}ms')
+            self.acquisition_cancelled.emit(stall)
+
+    def publish(self, image):
+        """
+        hands the image on to the frame buffer, encoded images from next_frame go through the decode pool first
+        """
+        stamps, self.stamps = self.stamps, {}
+        trigger_index = None if self.frame_number is None else self.frame_number // self.nimages
+        self.frame_number = None
+        if self.decode_pool is None or isinstance(image, np.ndarray):
+            self.push(image, (stamps, trigger_index))
+        elif isinstance(image, tuple):
+            # raw stream image as (dimage_d header, data)
+            self.decode_pool.submit(image[1], image[0], (stamps, trigger_index))
         else:
-            # simulated image for @home use
-            self.exposure_triggered.emit()
-            sleep(1)
-            x = np.linspace(-10, 10, 512)
-            xs, ys = np.meshgrid(x, x)
-            img = 5e4 * ((np.cos(np.hypot(xs, ys)) / (np.hypot(xs, ys)+1) * np.random.normal(1, 0.4, (512, 512))) + 0.3)
-            self.image_ready.emit(img)
+            self.decode_pool.submit(image, tag=(stamps, trigger_index))
 
-        self.image_grabber_thread.quit()
-        log.debug(f'quit image_grabber_thread {self.image_grabber_thread.currentThread()}')
+    def push(self, image, tag=None):
+        """
+        copies the image into the frame buffer along with its trigger index, starts its latency trace and announces
+        its sequence number; tag is (stamps, trigger index)
+        """
+        stamps, trigger_index = tag or ({}, None)
+        stamps.setdefault('decoded', perf_counter())
+        seq = self.frames.push(image, trigger_index)
+        self.tracer.record(seq, stamps)
+        self.frame_ready.emit(seq)
+
+    def next_frame(self):
+        """
+        returns the next image from the configured source as a np.ndarray or None if interrupted or the link was
+        lost; with a decode pool the image is returned encoded, as it came from the source
+        """
+        decode = self.decode_pool is None
+        if self.receiver is not None:
+            image = None
+            while image is None and self.acquiring():
+                image = self.receiver.next_frame(decode=False)
+            self.stamps['downloaded'] = perf_counter()
+            self.frame_number = self.receiver.frame
+            if image is not None and decode:
+                image = decode_stream_image(*image)
+        else:
+            image = self.drain_image() if self.drain or self.external else self.wait_for_image()
+            if image is not None and decode:
+                image = monitor_to_array(image)
+        if image is not None and decode:
+            self.stamps['decoded'] = perf_counter()
+        if image is not None and 'exposure_end' in self.stamps:
+            self.image_latency.add(perf_counter() - self.stamps['exposure_end'])
+            log.debug(f'image latency {self.image_latency.values[-1] * 1e3:.1f}ms, rolling {self.image_latency}')
+        return image
+
+    def wait_for_image(self):
+        """
+        long-polling the monitor for the next image until the thread is interrupted or the link is lost; a cancel or
+        suspend interrupts the running request. returns None if interrupted
+        """
+        while self.acquiring():
+            image = self.Q.mon.next_image(stamps=self.stamps)
+            if image is not None:
+                return image
+        return None
+
+    def drain_image(self):
+        """
+        returns the oldest image in the monitor buffer that was not fetched yet, listing the buffer again only when all
+        images of the last listing are fetched; images that left the buffer before they were fetched are counted as
+        lost; returns None if interrupted or the link is lost
+        """
+        image = None
+        while image is None:
+            interval = STATE_POLL_MIN
+            while True:
+                if not self.acquiring():
+                    return None
+                if self.drain_queue:
+                    break
+                self.__list_images()
+                if not self.drain_queue:
+                    sleep(interval)
+                    interval = min(2 * interval, STATE_POLL_MAX)
+            image_id = self.drain_queue.popleft()
+            image = self.Q.mon.image(*image_id, stamps=self.stamps)
+            if image is None:
+                self.n_lost += 1
+                log.warning(f'image {image_id[1]} of series {image_id[0]} left the monitor buffer before it was '
+                            f'fetched, {self.n_lost} lost in total')
+        self.frame_number = image_id[1] - 1
+        self.stamps['listed'] = self.t_listed
+        return image
+
+    def reset_drain(self):
+        """
+        forgets the images listed for draining once the monitor was cleared, they cannot be fetched anymore
+        """
+        self.drain_queue.clear()
+        self.last_image_id = (0, 0)
+
+    def __list_images(self):
+        """
+        queues the images in the monitor buffer newer than the last one fetched, counting the missing image ids
+        """
+        self.t_listed = perf_counter()
+        for series, image_id in sorted(tuple(i) for i in self.Q.mon.image_list):
+            if (series, image_id) <= self.last_image_id:
+                continue
+            last_series, last_id = self.last_image_id
+            n_missing = image_id - last_id - 1 if series == last_series else image_id - 1
+            if n_missing > 0:
+                self.n_lost += n_missing
+                log.warning(f'lost {n_missing} images before image {image_id} of series {series}, '
+                            f'{self.n_lost} in total')
+            self.last_image_id = (series, image_id)
+            self.drain_queue.append((series, image_id))
+
+    def set_ntrigger(self, ntrigger):
+        """
+        only write ntrigger to the detector if it differs from the mirrored value
+        """
+        if ntrigger != self.Q.ntrigger:
+            self.Q.ntrigger = ntrigger
 
     def wait_for_state(self, state_name, logic=True):
         """
-        making sure waiting for the detector to enter or leave a state is not blocking the interruption of the thread
+        making sure waiting for the detector to leave (logic=True) or enter (logic=False) a state is not blocking the
+        interruption of the thread; polling starts fast and backs off
         """
         log.debug(f'waiting for state: {state_name} to be {logic}')
-        if logic:
-            while self.Q.state == state_name:
-                if self.image_grabber_thread.isInterruptionRequested():
-                    self.image_grabber_thread.quit()
-                    return
-                sleep(0.05)
-            return
-        while self.Q.state != state_name:
+        t0 = perf_counter()
+        interval = STATE_POLL_MIN
+        while (self.Q.state == state_name) == logic:
             if self.image_grabber_thread.isInterruptionRequested():
-                self.image_grabber_thread.quit()
                 return
-            sleep(0.05)
+            sleep(interval)
+            interval = min(2 * interval, STATE_POLL_MAX)
+        transition = f'{"leave" if logic else "enter"} {state_name}'
+        if transition not in self.transition_times:
+            self.transition_times[transition] = RollingStats()
+        self.transition_times[transition].add(perf_counter() - t0)
+        log.debug(f'{transition} took {(perf_counter() - t0) * 1e3:.1f}ms')
+
+    def transition_summary(self):
+        """
+        returns the rolling durations of the state transitions waited for as text, for diagnostics
+        """
+        if not self.transition_times:
+            return 'no data'
+        return ', '.join(f'{transition} {stats}' for transition, stats in self.transition_times.items())
 
 
 class DectrisStatusGrabber(QObject):
@@ -126,32 +691,61 @@ class DectrisStatusGrabber(QObject):
     class for continiously retrieving status information from the DCU
     """
     status_ready = pyqtSignal(dict)
+    config_changed = pyqtSignal(dict)
+    # emitted when a status read fails after the previous ones succeeded
+    link_lost = pyqtSignal()
     connected = False
 
     def __init__(self, ip, port):
         super().__init__()
 
-        self.Q = Quadro(ip, port)
-        try:
-            _ = self.Q.state
-            self.connected = True
-            log.info('DectrisStatusGrabber successfully connected to detector')
-        except OSError:
-            log.warning('DectrisStatusGrabber could not establish connection to detector')
+        self.t_config_refresh = perf_counter()
+
+        # the connection is not probed here, the first status read tells
+        self.Q = get_detector(ip, port)
+
+        self.executor = ThreadPoolExecutor(max_workers=len(STATUS_READS), thread_name_prefix='status')
 
         self.status_grabber_thread = QThread()
         self.moveToThread(self.status_grabber_thread)
         self.status_grabber_thread.started.connect(self.__get_status)
 
+    def __timed_read(self, read):
+        t0 = perf_counter()
+        return read(self.Q), perf_counter() - t0
+
     @pyqtSlot()
     def __get_status(self):
+        """
+        reads all of STATUS_READS concurrently and emits them as one snapshot, together with the time each read took
+        """
         log.debug(f'started status_grabber_thread {self.status_grabber_thread.currentThread()}')
-        if self.connected:
-            self.status_ready.emit({'quadro': self.Q.state, 'fw': self.Q.fw.state, 'mon': self.Q.mon.state,
-                                    'trigger_mode': self.Q.trigger_mode, 'exposure': self.Q.frame_time,
-                                    'counting_mode': self.Q.counting_mode})
+        t0 = perf_counter()
+        futures = {key: self.executor.submit(self.__timed_read, read) for key, read in STATUS_READS.items()}
+        status = {'timings': {}}
+        changed = None
+        try:
+            for key, future in futures.items():
+                status[key], status['timings'][key] = future.result()
+            status['timings']['total'] = perf_counter() - t0
+            if perf_counter() - self.t_config_refresh > CONFIG_REFRESH_INTERVAL:
+                self.t_config_refresh = perf_counter()
+                changed = self.Q.refresh()
+        except OSError as e:
+            if self.connected:
+                log.warning(f'DectrisStatusGrabber lost connection to detector: {e}')
+                self.connected = False
+                self.link_lost.emit()
+            self.status_ready.emit({'quadro': None, 'fw': None, 'mon': None, 'trigger_mode': None, 'exposure': None, 'counting_mode': None,
+                                    'timings': {}})
         else:
-            self.status_ready.emit({'quadro': None, 'fw': None, 'mon': None, 'trigger_mode': None, 'exposure': None, 'counting_mode': None})
+            if not self.connected:
+                log.info('DectrisStatusGrabber successfully connected to detector')
+            self.connected = True
+            log.debug(f'status refresh took {status["timings"]["total"] * 1e3:.1f}ms')
+            self.status_ready.emit(status)
+            if changed:
+                self.config_changed.emit(changed)
         self.status_grabber_thread.quit()
         log.debug(f'quit status_grabber_thread {self.status_grabber_thread.currentThread()}')
 
@@ -181,24 +775,123 @@ class ConstantPing(QObject):
             sleep(self.period)
 
 
+class LinkSupervisor(QObject):
+    """
+    reconnecting to the detector in the background once the link is lost, with exponentially growing pauses between
+    the attempts; the image grabber is set up again with its configuration before its acquisition goes on
+    """
+    link_lost = pyqtSignal()
+    # seconds the link was down
+    link_restored = pyqtSignal(float)
+
+    def __init__(self, grabber):
+        super().__init__()
+
+        self.grabber = grabber
+        self.n_losses = 0
+
+        self.supervisor_thread = QThread()
+        self.moveToThread(self.supervisor_thread)
+        self.supervisor_thread.started.connect(self.__reconnect)
+
+    def __sleep(self, seconds):
+        """
+        sleeps in short steps to not block the interruption of the thread, returns False if it was interrupted
+        """
+        t_end = perf_counter() + seconds
+        while perf_counter() < t_end:
+            if self.supervisor_thread.isInterruptionRequested():
+                return False
+            sleep(min(LINK_POLL, t_end - perf_counter()))
+        return True
+
+    @pyqtSlot()
+    def __reconnect(self):
+        t_lost = perf_counter()
+        self.n_losses += 1
+        self.grabber.suspend()
+        self.link_lost.emit()
+        delay = RECONNECT_MIN
+        n_attempts = 0
+        while self.__sleep(delay):
+            n_attempts += 1
+            try:
+                self.grabber.restore()
+            except OSError as e:
+                delay = min(2 * delay, RECONNECT_MAX)
+                log.debug(f'reconnection attempt {n_attempts} failed: {e}, next one in {delay:.1f}s')
+                continue
+            downtime = perf_counter() - t_lost
+            log.info(f'link to the detector restored after {downtime:.1f}s and {n_attempts} attempts')
+            self.link_restored.emit(downtime)
+            break
+        self.supervisor_thread.quit()
+
+
+class RenderScheduler(QObject):
+    """
+    passing on only the newest frame of a FrameRingBuffer, at most max_fps times per second, so that displaying
+    never holds up acquisition
+    """
+    render = pyqtSignal(int, np.ndarray)
+
+    def __init__(self, frames, max_fps=30, stages=None, tracer=None):
+        super().__init__()
+
+        self.frames = frames
+        self.stages = stages or StageStats()
+        self.tracer = tracer
+        self.min_interval = 1 / max_fps
+        self.pending = False
+        self.t_last_render = 0
+        self.last_seq = None
+        self.n_rendered = 0
+        self.n_skipped = 0
+
+    @pyqtSlot(int)
+    def frame_available(self, seq):
+        """
+        schedules rendering the newest frame as soon as the rate limit allows it
+        """
+        if self.pending:
+            return
+        self.pending = True
+        delay = self.t_last_render + self.min_interval - perf_counter()
+        QTimer.singleShot(max(int(delay * 1000), 0), self.__render)
+
+    @pyqtSlot()
+    def __render(self):
+        self.pending = False
+        frame = self.frames.pop_latest()
+        if frame is None:
+            return
+        seq, image = frame
+        if self.last_seq is not None:
+            self.n_skipped += seq - self.last_seq - 1
+        self.last_seq = seq
+        self.n_rendered += 1
+        self.t_last_render = perf_counter()
+        if self.tracer is not None:
+            self.tracer.stamp(seq, 'handed', self.t_last_render)
+        with self.stages.busy('render'):
+            self.render.emit(seq, image)
+
+    def stats(self):
+        return {'rendered': self.n_rendered, 'skipped': self.n_skipped}
+
+
 def interrupt_acquisition(f):
     """
-    decorator interrupting/resuming image acquisition before/after function call
+    decorator interrupting image acquisition before the function call and resuming it after; the call is queued until
+    the acquisition stopped, see LiveViewUi.resume_acquisition, so that the GUI thread never waits for the detector
     """
     def wrapper(self):
         log.debug('stopping liveview')
+        t0 = perf_counter()
         self.image_timer.stop()
-        if self.dectris_image_grabber.connected:
-            if not self.dectris_image_grabber.image_grabber_thread.isFinished():
-                log.debug('aborting acquisition')
-                self.dectris_image_grabber.Q.abort()
-                self.dectris_image_grabber.image_grabber_thread.requestInterruption()
-                self.dectris_image_grabber.image_grabber_thread.wait()
-                self.dectris_image_grabber.Q.mon.clear()
-        f(self)
-        if not self.actionStop.isChecked():
-            log.debug('restarting liveview')
-            self.image_timer.start(self.update_interval)
+        self.queued_calls.append(f)
+        self.dectris_image_grabber.cancel()
+        log.debug(f'GUI thread stalled {(perf_counter() - t0) * 1e3:.1f}ms for interrupting the acquisition')
     return wrapper
 
 
@@ -232,5 +925,5 @@ class RectROI(pg.RectROI):
         self.win.show()
 
     def add_mean(self, data, img):
-        self.last_means.append(self.getArrayRegion(data, img).mean())
+        self.last_means.append(self.getArrayRegion(data, img, axes=(1, 0)).mean())
         self.curve.setData(x=range(-len(self.last_means)+1, 1), y=self.last_means)
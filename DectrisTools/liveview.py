@@ -2,11 +2,15 @@
 liveview module
 this module starts the liveview ui
 """
+from time import perf_counter
+# start of the application for the startup time breakdown, before the heavy imports
+T_START = perf_counter()
 
 import logging as log
 from PyQt5 import QtWidgets
 from argparse import ArgumentParser
 from .ui.liveview import LiveViewUi
+from .lib.Stream import STREAM_PORT
 from. import IP, PORT
 
 
@@ -16,6 +20,25 @@ def parse_args():
     parser.add_argument('--port', type=int, default=PORT, help='DCU port')
     parser.add_argument('--verbose', action='store_true', help='enable verbose logging')
     parser.add_argument('--update_interval', type=int, default=50, help='time between dectector image calls in ms')
+    parser.add_argument('--single', action='store_true',
+                        help='re-arm the detector for every image instead of acquiring a continuous series')
+    parser.add_argument('--pipelined', action='store_true',
+                        help='trigger the next exposure while the previous image is still being read out')
+    parser.add_argument('--source', type=str, default='monitor', choices=['monitor', 'stream'],
+                        help='detector interface the images are read from')
+    parser.add_argument('--stream_port', type=int, default=STREAM_PORT, help='DCU stream interface port')
+    parser.add_argument('--max_fps', type=float, default=30, help='maximum rate at which images are displayed')
+    parser.add_argument('--decode_workers', type=int, default=0,
+                        help='number of processes decoding the images, 0 to decode in the acquisition thread')
+    parser.add_argument('--drain', action='store_true',
+                        help='fetch every image in the monitor buffer instead of only the next one, to not lose images')
+    parser.add_argument('--sim_rate', type=float, default=None,
+                        help='images per second simulated without detector, default 1/exposure, 0 for unlimited')
+    parser.add_argument('--sim_shape', type=int, nargs=2, default=[512, 512], metavar=('HEIGHT', 'WIDTH'),
+                        help='size of the images simulated without detector')
+    parser.add_argument('--sim_dtype', type=str, default='uint16', choices=['uint8', 'uint16', 'uint32', 'float32'],
+                        help='data type of the images simulated without detector')
+    parser.add_argument('--sim_seed', type=int, default=0, help='seed of the images simulated without detector')
 
     args = parser.parse_args()
 
@@ -36,7 +59,7 @@ def run():
 
     args = parse_args()
     app = QtWidgets.QApplication(sys.argv)
-    ui = LiveViewUi(args)
+    ui = LiveViewUi(args, t_start=T_START)
     sys.exit(app.exec_())
 
 
@@ -0,0 +1,61 @@
+"""
+module to run a local mock of the DCU, for testing and benchmarking the tools without hardware
+"""
+import logging as log
+from argparse import ArgumentParser
+from .lib.MockServer import MockDCU, MockServer
+from .lib.Simulator import DetectorSimulator
+
+
+def section_values(values, scale=1):
+    """
+    list of 'SECTION=VALUE' or 'VALUE' for all sections is returned as {section: VALUE * scale}
+    """
+    result = {}
+    for value in values or []:
+        section, _, value = value.rpartition('=')
+        result[section or 'default'] = float(value) * scale
+    return result
+
+
+def parse_args():
+    parser = ArgumentParser()
+    parser.add_argument('--host', type=str, default='localhost', help='address to serve on')
+    parser.add_argument('--port', type=int, default=8080, help='port to serve on')
+    parser.add_argument('--latency', type=str, action='append', metavar='[SECTION=]SECONDS',
+                        help='response latency of the API section (config, status, command, images, files, data) or '
+                             'of all sections, can be given multiple times')
+    parser.add_argument('--bandwidth', type=str, action='append', metavar='[SECTION=]MBPS',
+                        help='bandwidth in MB/s of the responses of the API section or of all sections')
+    parser.add_argument('--size', type=int, default=512, help='image width and height in pixels')
+    parser.add_argument('--dtype', type=str, default='uint16', choices=['uint8', 'uint16', 'uint32', 'float32'],
+                        help='data type of the images')
+    parser.add_argument('--seed', type=int, default=0, help='seed of the simulated images')
+    parser.add_argument('--ext_rate', type=float, default=10, help='rate of the simulated external triggers in Hz')
+    parser.add_argument('--stream_port', type=int, default=None,
+                        help='publish the images on this port when the stream interface is enabled')
+    parser.add_argument('--uninitialized', action='store_true', help='start in state na like a fresh DCU')
+    parser.add_argument('--verbose', action='store_true', help='log every request')
+    args = parser.parse_args()
+    return args
+
+
+def run():
+    args = parse_args()
+    log.basicConfig(format='[%(asctime)s] %(levelname)-8s | %(message)s', level='DEBUG' if args.verbose else 'INFO',
+                    datefmt='%H:%M:%S')
+    simulator = DetectorSimulator(0, (args.size, args.size), args.dtype, seed=args.seed)
+    dcu = MockDCU(simulator, ext_rate=args.ext_rate, initialized=not args.uninitialized,
+                  stream_port=args.stream_port)
+    server = MockServer(dcu, (args.host, args.port), latency=section_values(args.latency),
+                        bandwidth=section_values(args.bandwidth, 1e6))
+    log.info(f'mock DCU serving {simulator} on {args.host} port {args.port}')
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    server.server_close()
+
+
+if __name__ == '__main__':
+    run()
@@ -5,7 +5,7 @@ from time import sleep
 import warnings
 from os import getcwd
 from argparse import ArgumentParser
-from uedinst.dectris import Quadro
+from .lib.Simplon import get_detector
 from . import IP, PORT
 
 warnings.simplefilter("ignore", ResourceWarning)
@@ -24,7 +24,7 @@ def run(cmd_args):
     if cmd_args.savedir is None:
         cmd_args.savedir = getcwd()
 
-    Q = Quadro(cmd_args.ip, cmd_args.port)
+    Q = get_detector(cmd_args.ip, cmd_args.port)
 
     old_n_imgs = Q.fw.nimages_per_file
     Q.fw.nimages_per_file = 0
@@ -4,7 +4,7 @@ module to continiously print the current state of the detector and it's subsyste
 import os
 from argparse import ArgumentParser
 from time import sleep
-from uedinst.dectris import Quadro
+from .lib.Simplon import get_detector
 from . import IP, PORT
 
 
@@ -26,13 +26,14 @@ def clear_output():
 
 def run():
     args = parse_args()
-    q = Quadro(args.ip, args.port)
+    q = get_detector(args.ip, args.port)
 
     while True:
         print(q)
         print(f'detector state:           {q.state}')
         print(f'monitor state:            {q.mon.state}')
         print(f'filewriter state:         {q.fw.state}')
+        print(f'requests/connections:     {q.client.n_requests}/{q.client.n_connections}')
         sleep(args.update_interval/1000)
         clear_output()
 
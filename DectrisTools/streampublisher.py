@@ -0,0 +1,45 @@
+"""
+module to publish simulated images in the format of the DCU stream interface, for testing the liveview without hardware
+"""
+import logging as log
+from argparse import ArgumentParser
+from .lib.Stream import StreamPublisher, STREAM_PORT
+from .lib.Simulator import DetectorSimulator
+
+
+def parse_args():
+    parser = ArgumentParser()
+    parser.add_argument('--port', type=int, default=STREAM_PORT, help='port to bind the stream to')
+    parser.add_argument('--rate', type=float, default=10, help='images per second, 0 for unlimited')
+    parser.add_argument('--size', type=int, default=512, help='image width and height in pixels')
+    parser.add_argument('--dtype', type=str, default='uint16', choices=['uint8', 'uint16', 'uint32', 'float32'],
+                        help='data type of the images')
+    parser.add_argument('--seed', type=int, default=0, help='seed of the simulated images')
+    parser.add_argument('--n_images', type=int, default=0, help='number of images to send, 0 for unlimited')
+    args = parser.parse_args()
+    return args
+
+
+def run():
+    log.basicConfig(format='[%(asctime)s] %(levelname)-8s | %(message)s', level='INFO', datefmt='%H:%M:%S')
+    args = parse_args()
+    publisher = StreamPublisher(args.port)
+
+    simulator = DetectorSimulator(args.rate, (args.size, args.size), args.dtype, seed=args.seed)
+    log.info(f'publishing images of {simulator}')
+
+    publisher.send_header(1)
+    frame = 0
+    try:
+        while args.n_images == 0 or frame < args.n_images:
+            publisher.send_image(simulator.next_frame(), 1, frame)
+            frame += 1
+    except KeyboardInterrupt:
+        pass
+    publisher.send_end(1)
+    log.info(f'sent {frame} images')
+    publisher.close()
+
+
+if __name__ == '__main__':
+    run()
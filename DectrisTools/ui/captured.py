@@ -16,7 +16,6 @@ class CapturedUi(QtWidgets.QMainWindow):
         self.viewer.setImage(image, autoRange=True, autoLevels=True)
         self.image = image
         self.i_digits = len(str(int(self.image.max(initial=1))))
-        self.viewer.x_size, self.viewer.y_size = self.image.shape
 
         self.viewer.cursor_changed.connect(self.update_statusbar)
         self.setWindowTitle(f'Captured Image - {datetime.now().strftime("%Y%m%d %H%M%S")}')
@@ -31,5 +30,5 @@ class CapturedUi(QtWidgets.QMainWindow):
             self.statusbar.showMessage('')
             return
         x, y = xy
-        i = self.image[x, y]
+        i = self.image[self.viewer.raw_index(x, y)]
         self.statusbar.showMessage(f'({x:4d}, {y:4d}) | I={i:{self.i_digits}.0f}')
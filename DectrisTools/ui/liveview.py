@@ -4,8 +4,10 @@ import numpy as np
 from PyQt5 import QtWidgets, QtCore, QtGui, uic
 import pyqtgraph as pg
 from .. import get_base_path
-from ..lib.Utils import DectrisImageGrabber, DectrisStatusGrabber, ConstantPing, interrupt_acquisition, RectROI
-from .widgets import ROIView
+from ..lib.Utils import DectrisImageGrabber, DectrisStatusGrabber, ConstantPing, RenderScheduler, LinkSupervisor, \
+    interrupt_acquisition, RectROI, CANCEL_TIMEOUT
+from ..lib.Timing import StartupTimer
+from .widgets import ROIView, LatencyView
 from ..ui.captured import CapturedUi
 
 
@@ -14,34 +16,64 @@ class LiveViewUi(QtWidgets.QMainWindow):
     main window of the LiveView application
     """
     image = None
+    seq = None
     i_digits = 5
     update_interval = None
 
-    def __init__(self, cmd_args, *args, **kwargs):
+    def __init__(self, cmd_args, *args, t_start=None, **kwargs):
         log.debug('initializing DectrisLiveView')
+        # milestones since t_start, the start of the application, up to the first frame on screen
+        self.startup = StartupTimer(t_start)
         super().__init__(*args, **kwargs)
         uic.loadUi(path.join(get_base_path(), 'ui/liveview.ui'), self)
+        self.startup.mark('ui loaded')
+        self.cmd_args = cmd_args
         self.update_interval = cmd_args.update_interval
+        # the detector controls become valid once the grabber is set up, see detector_set_up
+        self.set_controls_enabled(False, False)
 
         self.dectris_image_grabber = DectrisImageGrabber(cmd_args.ip, cmd_args.port,
                                                          trigger_mode='ints',
-                                                         exposure=float(self.lineEditExposure.text()) / 1000)
-        if self.dectris_image_grabber.connected:
-            if self.dectris_image_grabber.Q.counting_mode == 'normal':
-                self.actionCmodeNormal.setChecked(True)
-            elif self.dectris_image_grabber.Q.counting_mode == 'retrigger':
-                self.actionCmodeRetrigger.setChecked(True)
+                                                         exposure=float(self.lineEditExposure.text()) / 1000,
+                                                         continuous=not cmd_args.single,
+                                                         pipelined=cmd_args.pipelined,
+                                                         source=cmd_args.source,
+                                                         stream_port=cmd_args.stream_port,
+                                                         decode_workers=cmd_args.decode_workers,
+                                                         drain=cmd_args.drain,
+                                                         simulation=self.simulation_args(cmd_args))
+        self.dectris_image_grabber.setup_finished.connect(self.detector_set_up)
         self.dectris_status_grabber = DectrisStatusGrabber(cmd_args.ip, cmd_args.port)
+        # reconnects in the background if the detector is unreachable at startup or the link is lost later
+        self.link_supervisor = LinkSupervisor(self.dectris_image_grabber)
+        self.dectris_status_grabber.link_lost.connect(self.link_supervisor.supervisor_thread.start)
+        self.link_supervisor.link_lost.connect(self.detector_link_lost)
+        self.link_supervisor.link_restored.connect(self.detector_link_restored)
         self.exposure_progress_worker = ConstantPing()
         self.dectris_image_grabber.exposure_triggered.connect(self.exposure_progress_worker.progress_thread.start)
 
+        # in continuous mode the grabber thread keeps running and the timer only restarts it after a finished series
         self.image_timer = QtCore.QTimer()
         self.image_timer.timeout.connect(self.dectris_image_grabber.image_grabber_thread.start)
-        self.dectris_image_grabber.image_ready.connect(self.update_image)
+        # calls waiting for the acquisition to stop, see interrupt_acquisition
+        self.queued_calls = []
+        # frame_time and trigger_mode as the detector was last set up or configured, reading them from the detector
+        # could block the GUI
+        self.detector_config = {}
+        self.dectris_image_grabber.acquisition_cancelled.connect(self.resume_acquisition)
+        self.dectris_image_grabber.config_applied.connect(self.detector_configured)
+        self.dectris_image_grabber.config_failed.connect(self.detector_configuration_failed)
+        self.frames = self.dectris_image_grabber.frames
+        self.tracer = self.dectris_image_grabber.tracer
+        self.render_scheduler = RenderScheduler(self.frames, max_fps=cmd_args.max_fps,
+                                                stages=self.dectris_image_grabber.stages, tracer=self.tracer)
+        self.dectris_image_grabber.frame_ready.connect(self.render_scheduler.frame_available)
+        self.render_scheduler.render.connect(self.update_image)
 
         self.status_timer = QtCore.QTimer()
         self.status_timer.timeout.connect(self.dectris_status_grabber.status_grabber_thread.start)
         self.dectris_status_grabber.status_ready.connect(self.update_status_labels)
+        self.dectris_status_grabber.config_changed.connect(self.update_external_config)
 
         self.exposure_progress_worker.advance_progress_bar.connect(self.advance_progress_bar)
 
@@ -49,6 +81,7 @@ class LiveViewUi(QtWidgets.QMainWindow):
         self.lineEditCapture.returnPressed.connect(self.capture_image)
 
         self.labelIntensity = QtWidgets.QLabel()
+        self.labelFrame = QtWidgets.QLabel()
         self.labelState = QtWidgets.QLabel()
         self.labelTrigger = QtWidgets.QLabel()
         self.labelExposure = QtWidgets.QLabel()
@@ -59,25 +92,57 @@ class LiveViewUi(QtWidgets.QMainWindow):
         self.init_statusbar()
         self.reset_progress_bar()
 
-        self.status_timer.start(200)
-
-        self.roi_view = ROIView(title='ROIs')
+        # the ROI and latency windows are only built when they are first shown
+        self.__roi_view = None
+        self.__latency_view = None
+        self.latency_timer = QtCore.QTimer()
+        self.latency_timer.timeout.connect(self.update_latency_view)
+        self.viewer.imageItem.painted.connect(self.trace_painted)
 
         self.show()
+        self.startup.mark('window shown')
+        # connecting to the detector and setting it up runs in the background
+        self.dectris_image_grabber.setup()
+
+    @property
+    def roi_view(self):
+        if self.__roi_view is None:
+            self.__roi_view = ROIView(title='ROIs')
+        return self.__roi_view
+
+    @property
+    def latency_view(self):
+        if self.__latency_view is None:
+            self.__latency_view = LatencyView(title='Latency')
+        return self.__latency_view
 
     def closeEvent(self, evt):
-        self.roi_view.hide()
+        for view in (self.__roi_view, self.__latency_view):
+            if view is not None:
+                view.hide()
+        self.latency_timer.stop()
         for i in self.viewer.view.addedItems:
             if isinstance(i, RectROI):
                 i.win.hide()
         self.hide()
         self.image_timer.stop()
         self.status_timer.stop()
-        self.dectris_image_grabber.image_grabber_thread.requestInterruption()
+        self.link_supervisor.supervisor_thread.requestInterruption()
+        # the window is closing, the cancelled acquisition must not be resumed
+        self.dectris_image_grabber.acquisition_cancelled.disconnect(self.resume_acquisition)
+        self.dectris_image_grabber.cancel()
         self.exposure_progress_worker.progress_thread.requestInterruption()
         self.exposure_progress_worker.progress_thread.wait()
         self.dectris_status_grabber.status_grabber_thread.wait()
-        self.dectris_image_grabber.image_grabber_thread.wait()
+        # a reconnection attempt in progress cannot be interrupted and may block on an unreachable detector
+        self.link_supervisor.supervisor_thread.wait(CANCEL_TIMEOUT * 1000)
+        self.dectris_image_grabber.image_grabber_thread.wait(CANCEL_TIMEOUT * 1000)
+        log.info(f'detector client statistics: {self.dectris_image_grabber.Q.client.stats()}')
+        log.info(f'frame buffer statistics: {self.frames.stats()}')
+        log.info(f'render statistics: {self.render_scheduler.stats()}')
+        log.info(f'median latencies: {self.tracer}')
+        log.info(f'state transitions: {self.dectris_image_grabber.transition_summary()}')
+        log.info(f'startup: {self.startup}')
         super().closeEvent(evt)
 
     def init_statusbar(self):
@@ -85,6 +150,7 @@ class LiveViewUi(QtWidgets.QMainWindow):
 
         status_label_font = QtGui.QFont('Courier', 9)
         self.labelIntensity.setFont(status_label_font)
+        self.labelFrame.setFont(status_label_font)
         self.labelState.setFont(status_label_font)
         self.labelTrigger.setFont(status_label_font)
         self.labelExposure.setFont(status_label_font)
@@ -96,6 +162,7 @@ class LiveViewUi(QtWidgets.QMainWindow):
         self.labelIntensity.setText(f'({"":>4s}, {"":>4s})   {"":>{self.i_digits}s}')
 
         self.statusbar.addPermanentWidget(self.labelIntensity)
+        self.statusbar.addPermanentWidget(self.labelFrame)
         self.statusbar.addPermanentWidget(self.labelState)
         self.statusbar.addPermanentWidget(self.labelTrigger)
         self.statusbar.addPermanentWidget(self.labelExposure)
@@ -117,6 +184,9 @@ class LiveViewUi(QtWidgets.QMainWindow):
         self.actionShowMaxPixelValue.setShortcut('M')
         self.actionShowFrame.triggered.connect(lambda x=self.actionShowFrame.isChecked(): self.viewer.show_frame(x))
         self.actionShowFrame.setShortcut('F')
+        self.actionShowLatency.triggered.connect(self.show_latency_view)
+        self.actionShowLatency.setShortcut('L')
+        self.actionSaveLatencyTrace.triggered.connect(self.save_latency_trace)
 
         trigger_mode_group = QtWidgets.QActionGroup(self)
         trigger_mode_group.addAction(self.actionINTS)
@@ -142,11 +212,51 @@ class LiveViewUi(QtWidgets.QMainWindow):
             self.labelIntensity.setText(f'({"":>4s}, {"":>4s})   {"":>{self.i_digits}s}')
             return
         x, y = xy
-        i = self.image[x, y]
+        i = self.image[self.viewer.raw_index(x, y)]
         self.labelIntensity.setText(f'({x:>4}, {y:>4}) I={i:>{self.i_digits}.0f}')
 
+    def set_controls_enabled(self, acquisition, detector):
+        """
+        the trigger modes need something to take images from, exposure, capture and counting mode the detector
+        """
+        for action in (self.actionINTS, self.actionEXTS, self.actionEXTE):
+            action.setEnabled(acquisition)
+        for control in (self.actionCmodeNormal, self.actionCmodeRetrigger, self.lineEditCapture):
+            control.setEnabled(detector)
+        # the exposure is set by the trigger in exte
+        self.lineEditExposure.setEnabled(detector and not self.actionEXTE.isChecked())
+
+    @QtCore.pyqtSlot(bool)
+    def detector_set_up(self, connected):
+        self.startup.mark('grabber set up')
+        if connected:
+            # mirrored while setting up the grabber
+            counting_mode = self.dectris_image_grabber.Q.counting_mode
+            self.actionCmodeNormal.setChecked(counting_mode == 'normal')
+            self.actionCmodeRetrigger.setChecked(counting_mode == 'retrigger')
+            profile = self.dectris_image_grabber.profile
+            self.detector_config.update(frame_time=profile['frame_time'], trigger_mode=profile['trigger_mode'])
+            self.status_timer.start(200)
+        else:
+            self.link_supervisor.supervisor_thread.start()
+        self.set_controls_enabled(True, connected)
+        self.reset_progress_bar()
+
+    @QtCore.pyqtSlot()
+    def detector_link_lost(self):
+        self.status_timer.stop()
+        self.set_controls_enabled(True, False)
+        if self.dectris_image_grabber.connected:
+            self.statusbar.showMessage('lost the link to the detector, reconnecting...')
+
+    @QtCore.pyqtSlot(float)
+    def detector_link_restored(self, downtime):
+        self.detector_set_up(True)
+        self.statusbar.showMessage(f'link to the detector restored after {downtime:.1f}s', 5000)
+
     @QtCore.pyqtSlot(dict)
     def update_status_labels(self, states):
+        self.startup.mark('first status')
         if states['quadro'] is None:
             self.labelState.setText(f'Detector: {"":>7s} Monitor: {"":>7s}')
             self.labelTrigger.setText(f'Trigger: {"":>4s}')
@@ -160,9 +270,41 @@ class LiveViewUi(QtWidgets.QMainWindow):
             self.labelExposure.setText(f'Exposure: {states["exposure"] * 1000:>5.0f}ms')
             self.labelCmode.setText(f'Counting: {states["counting_mode"]:>9s}')
 
-    @QtCore.pyqtSlot(np.ndarray)
-    def update_image(self, image):
+    @QtCore.pyqtSlot(dict)
+    def update_external_config(self, changed):
+        """
+        reflect configuration changes made by another client in the controls
+        """
+        if 'counting_mode' in changed:
+            self.actionCmodeNormal.setChecked(changed['counting_mode'][1] == 'normal')
+            self.actionCmodeRetrigger.setChecked(changed['counting_mode'][1] == 'retrigger')
+        if 'trigger_mode' in changed:
+            for action, mode in ((self.actionINTS, 'ints'), (self.actionEXTS, 'exts'), (self.actionEXTE, 'exte')):
+                if changed['trigger_mode'][1] == mode and not self.actionStop.isChecked():
+                    action.setChecked(True)
+        self.detector_config.update({param: changed[param][1] for param in ('frame_time', 'trigger_mode')
+                                     if param in changed})
+        if 'frame_time' in changed:
+            self.lineEditExposure.setText(f'{changed["frame_time"][1] * 1000:g}')
+            self.reset_progress_bar()
+
+    @staticmethod
+    def simulation_args(cmd_args):
+        """
+        keyword arguments of the DetectorSimulator used without detector
+        """
+        kwargs = {'shape': tuple(cmd_args.sim_shape), 'dtype': cmd_args.sim_dtype, 'seed': cmd_args.sim_seed}
+        if cmd_args.sim_rate is not None:
+            kwargs['rate'] = cmd_args.sim_rate
+        return kwargs
+
+    @QtCore.pyqtSlot(int, np.ndarray)
+    def update_image(self, seq, image):
+        self.startup.mark('first frame')
         self.image = image
+        self.seq = seq
+        trigger_index = self.frames.info(seq)
+        self.labelFrame.setText('' if trigger_index is None else f'trigger {trigger_index:>6d}')
         self.viewer.clear()
         self.viewer.setImage(image,
                              max_label=self.actionShowMaxPixelValue.isChecked(),
@@ -173,32 +315,88 @@ class LiveViewUi(QtWidgets.QMainWindow):
         self.exposure_progress_worker.progress_thread.wait()
         self.reset_progress_bar()
 
+    @QtCore.pyqtSlot(float)
+    def resume_acquisition(self, stall):
+        """
+        runs the calls queued by interrupt_acquisition once the acquisition stopped and restarts it
+        """
+        log.info(f'acquisition stopped after {stall * 1e3:.0f}ms')
+        while self.queued_calls:
+            self.queued_calls.pop(0)(self)
+        if not self.actionStop.isChecked():
+            log.debug('restarting liveview')
+            self.image_timer.start(self.update_interval)
+
+    @QtCore.pyqtSlot(dict)
+    def detector_configured(self, applied):
+        log.info(f'detector configured: {applied}')
+        self.detector_config.update({param: applied[param] for param in ('frame_time', 'trigger_mode')
+                                     if param in applied})
+        if 'frame_time' in applied:
+            self.reset_progress_bar()
+
+    @QtCore.pyqtSlot(str, str)
+    def detector_configuration_failed(self, param, error):
+        self.statusbar.showMessage(f'could not set {param}: {error}', 5000)
+
+    @QtCore.pyqtSlot()
+    def trace_painted(self):
+        if self.seq is not None:
+            self.tracer.stamp(self.seq, 'painted')
+            if self.startup.mark('first paint'):
+                log.info(f'startup: {self.startup}')
+
+    @QtCore.pyqtSlot()
+    def show_latency_view(self):
+        if self.actionShowLatency.isChecked():
+            self.update_latency_view()
+            self.latency_view.show()
+            self.latency_timer.start(1000)
+        else:
+            self.latency_view.hide()
+            self.latency_timer.stop()
+
+    @QtCore.pyqtSlot()
+    def update_latency_view(self):
+        self.latency_view.update_histograms(self.tracer.histograms())
+
+    @QtCore.pyqtSlot()
+    def save_latency_trace(self):
+        filename, _ = QtWidgets.QFileDialog.getSaveFileName(self, 'Save Latency Trace', 'latency.csv',
+                                                            'CSV files (*.csv)')
+        if filename:
+            self.tracer.dump(filename)
+            log.info(f'saved latency trace to {filename}')
+
     @interrupt_acquisition
     @QtCore.pyqtSlot()
     def capture_image(self):
         log.info('capturing image')
         if self.dectris_image_grabber.connected:
-            if self.dectris_image_grabber.Q.trigger_mode == 'ints':
+            if self.detector_config.get('trigger_mode') == 'ints':
                 try:
                     time = float(self.lineEditCapture.text()) / 1000
                 except (ValueError, TypeError):
                     log.warning(f'image capture: cannot convert {self.lineEditCapture.text()} to float')
                     return
                 
-                self.dectris_image_grabber.Q.trigger_mode = 'ints'
-                self.dectris_image_grabber.Q.count_time = time
-                self.dectris_image_grabber.Q.frame_time = time
+                self.dectris_image_grabber.configure(trigger_mode='ints', count_time=time, frame_time=time)
 
-                self.dectris_image_grabber.image_ready.disconnect(self.update_image)
-                self.dectris_image_grabber.image_ready.connect(self.show_captured_image)
+                self.dectris_image_grabber.continuous = False
+                self.dectris_image_grabber.frame_ready.disconnect(self.render_scheduler.frame_available)
+                self.dectris_image_grabber.frame_ready.connect(self.show_captured_image)
                 self.dectris_image_grabber.image_grabber_thread.start()
 
-    @QtCore.pyqtSlot(np.ndarray)
-    def show_captured_image(self, image):
+    @QtCore.pyqtSlot(int)
+    def show_captured_image(self, seq):
         log.info('showing captured image')
-        self.dectris_image_grabber.image_ready.disconnect(self.show_captured_image)
-        self.dectris_image_grabber.image_ready.connect(self.update_image)
-        CapturedUi(image, parent=self)
+        self.dectris_image_grabber.frame_ready.disconnect(self.show_captured_image)
+        self.dectris_image_grabber.frame_ready.connect(self.render_scheduler.frame_available)
+        self.dectris_image_grabber.continuous = not self.cmd_args.single
+        # not leased, the displayed frame keeps its slot; the single image acquisition is over, so the slot is not
+        # written before it is copied
+        _, image = self.frames.pop_latest(lease=False)
+        CapturedUi(image.copy(), parent=self)
         self.update_exposure()
         self.update_trigger_mode()
 
@@ -211,30 +409,32 @@ class LiveViewUi(QtWidgets.QMainWindow):
             self.progressBarExposure.setValue(self.progressBarExposure.minimum())
         else:
             self.labelStop.setText('')
+            self.startup.mark('acquisition started')
             if not self.image_timer.isActive():
                 self.image_timer.start(self.update_interval)
             if self.actionINTS.isChecked():
                 mode = 'ints'
-                self.lineEditExposure.setEnabled(True)
+                self.lineEditExposure.setEnabled(self.dectris_image_grabber.connected)
             elif self.actionEXTS.isChecked():
                 mode = 'exts'
-                self.lineEditExposure.setEnabled(True)
+                self.lineEditExposure.setEnabled(self.dectris_image_grabber.connected)
             else:
                 mode = 'exte'
                 self.lineEditExposure.setEnabled(False)
             log.info(f'changing trigger mode to {mode}')
             if self.dectris_image_grabber.connected:
-                self.dectris_image_grabber.Q.trigger_mode = mode
+                self.dectris_image_grabber.configure(trigger_mode=mode)
             else:
                 log.warning(f'could not change trigger mode, detector disconnected')
 
+    @interrupt_acquisition
     @QtCore.pyqtSlot()
     def update_counting_mode(self):
         if self.dectris_image_grabber.connected:
             if self.actionCmodeNormal.isChecked():
-                self.dectris_image_grabber.Q.counting_mode = 'normal'
+                self.dectris_image_grabber.configure(counting_mode='normal')
             else:
-                self.dectris_image_grabber.Q.counting_mode = 'retrigger'
+                self.dectris_image_grabber.configure(counting_mode='retrigger')
 
     @interrupt_acquisition
     @QtCore.pyqtSlot()
@@ -247,8 +447,7 @@ class LiveViewUi(QtWidgets.QMainWindow):
 
         log.info(f'changing exporue time to {time}')
         if self.dectris_image_grabber.connected:
-            self.dectris_image_grabber.Q.count_time = time
-            self.dectris_image_grabber.Q.frame_time = time
+            self.dectris_image_grabber.configure(count_time=time, frame_time=time)
         else:
             log.warning(f'could not change exposure time, detector disconnected')
 
@@ -260,13 +459,13 @@ class LiveViewUi(QtWidgets.QMainWindow):
             self.progressBarExposure.setValue(self.progressBarExposure.maximum())
 
     def reset_progress_bar(self):
-        if self.dectris_image_grabber.connected:
-            time = self.progressBarExposure.setMaximum(int(self.dectris_image_grabber.Q.frame_time * 100))
+        frame_time = self.detector_config.get('frame_time')
+        if self.dectris_image_grabber.connected and frame_time is not None:
+            time = int(frame_time * 100)
         else:
             time = 100
         self.progressBarExposure.setValue(0)
-        if time is not None:
-            self.progressBarExposure.setMaximum(time)
+        self.progressBarExposure.setMaximum(time)
 
     @QtCore.pyqtSlot()
     def start_acquisition(self):
@@ -276,7 +475,7 @@ class LiveViewUi(QtWidgets.QMainWindow):
     def add_rect_roi(self):
         if self.image is not None:
             log.info('added rectangular ROI')
-            roi = RectROI((self.image.shape[0] / 2 - 50, self.image.shape[1] / 2 - 50), (100, 100),
+            roi = RectROI((self.viewer.x_size / 2 - 50, self.viewer.y_size / 2 - 50), (100, 100),
                           centered=True, sideScalers=True,
                           pen=pg.mkPen('c', width=2), hoverPen=pg.mkPen('c', width=3),
                           handlePen=pg.mkPen('w', width=3), handleHoverPen=pg.mkPen('w', width=4))
@@ -299,7 +498,7 @@ class LiveViewUi(QtWidgets.QMainWindow):
 
     @QtCore.pyqtSlot(tuple)
     def update_roi(self, roi):
-        roi_data = roi.getArrayRegion(self.image, self.viewer.imageItem)
+        roi_data = roi.getArrayRegion(self.image, self.viewer.imageItem, axes=(1, 0))
         roi.add_mean(self.image, self.viewer.imageItem)
         roi.plot_item.clear()
         roi.plot_item.plot(roi_data.mean(axis=np.argmin(roi_data.shape)))
@@ -2,22 +2,36 @@ from copy import copy, deepcopy
 import logging as log
 import weakref
 import pyqtgraph as pg
-from pyqtgraph.Qt import QtGui, QtWidgets
+from pyqtgraph.Qt import QtCore, QtGui, QtWidgets
 from pyqtgraph.graphicsItems.ViewBox.ViewBoxMenu import ui_template
 import numpy as np
 from PyQt5.QtCore import pyqtSignal, pyqtSlot
 
 
+class PaintedImageItem(pg.ImageItem):
+    """
+    ImageItem announcing every time it was painted, for tracing when the pixels are on screen
+    """
+    painted = pyqtSignal()
+
+    def paint(self, *args):
+        super().paint(*args)
+        self.painted.emit()
+
+
 class ImageViewWidget(pg.ImageView):
     x_size = 0
     y_size = 0
     image = None
     raw_image = None
+    # counts the images set, the scaled image is derived once per version and scale
+    version = 0
+    scaled_key = None
     cursor_changed = pyqtSignal(tuple)
 
     def __init__(self, parent=None, cmap='inferno'):
         log.debug('initializing ImageViewWidget')
-        super().__init__()
+        super().__init__(imageItem=PaintedImageItem())
         self.setParent(parent)
         self.setPredefinedGradient(cmap)
         self.setLevels(0, 2**16)
@@ -54,14 +68,15 @@ class ImageViewWidget(pg.ImageView):
         self.addItem(self.max_label)
 
     def setImage(self, *args, max_label=False, projections=False, **kwargs):
-        self.raw_image = copy(args[0])
-        self.image = args[0]
-        self.x_size, self.y_size = self.image.shape
-
-        if self.view.menu.logScale.isChecked():
-            self.image = np.log(self.image, where=self.image > 0)
-        elif self.view.menu.sqrtScale.isChecked():
-            self.image = np.sqrt(self.image, where=self.image > 0)
+        """
+        images are expected in the orientation of the detector, rows along the first axis; they are displayed rotated
+        by the transform of the image item instead of rotating the data. the image is referenced, not copied: it has to
+        stay unchanged while it is displayed, like a frame leased from the FrameRingBuffer until the next pop
+        """
+        self.raw_image = args[0]
+        self.version += 1
+        self.y_size, self.x_size = self.raw_image.shape
+        self.image = self.__scaled()
 
         if max_label:
             self.max_label.setText(f'<span style="font-size: 32pt">{int(self.image.max())}</span>')
@@ -69,34 +84,62 @@ class ImageViewWidget(pg.ImageView):
             self.max_label.setText('')
 
         if projections:
-            x_projection_data = np.mean(self.image, axis=0)
+            # rows are displayed bottom to top
+            x_projection_data = np.mean(self.image, axis=1)[::-1]
             x_projection_data /= np.mean(x_projection_data)
-            x_projection_data *= self.image.shape[1] * 0.1
-            self.x_projection.setData(x=x_projection_data, y=np.arange(0, self.image.shape[1]) + 0.5)
+            x_projection_data *= self.y_size * 0.1
+            self.x_projection.setData(x=x_projection_data, y=np.arange(0, self.y_size) + 0.5)
 
-            y_projection_data = np.mean(self.image, axis=1)
+            y_projection_data = np.mean(self.image, axis=0)
             y_projection_data /= np.max(y_projection_data)
-            y_projection_data *= self.image.shape[0] * 0.1  # make plot span 10% of the image
-            self.y_projection.setData(x=np.arange(0, self.image.shape[0]) + 0.5, y=y_projection_data)
+            y_projection_data *= self.x_size * 0.1  # make plot span 10% of the image
+            self.y_projection.setData(x=np.arange(0, self.x_size) + 0.5, y=y_projection_data)
         else:
             self.x_projection.clear()
             self.y_projection.clear()
 
-        auto_levels = self.view.menu.autoLevels.isChecked()
-        super().setImage(self.image, *args[1:], autoLevels=auto_levels,
-                         autoHistogramRange=auto_levels, autoRange=False, **kwargs)
+        auto_levels = kwargs.pop('autoLevels', self.view.menu.autoLevels.isChecked())
+        self.__display(self.image, *args[1:], autoLevels=auto_levels, autoHistogramRange=auto_levels, **kwargs)
+
+    def __display(self, image, *args, autoRange=False, **kwargs):
+        """
+        hands the image to pg.ImageView, columns along x and rows along y, flipped upside down
+        """
+        super().setImage(image, *args, autoRange=autoRange, axes={'x': 1, 'y': 0},
+                         transform=QtGui.QTransform(1, 0, 0, -1, 0, image.shape[0]), **kwargs)
+
+    def __scaled(self):
+        """
+        returns the raw image in the scale selected in the menu, values <= 0 are 0 in log and sqrt scale
+        """
+        if self.view.menu.logScale.isChecked():
+            scale = np.log
+        elif self.view.menu.sqrtScale.isChecked():
+            scale = np.sqrt
+        else:
+            scale = None
+        if self.scaled_key != (self.version, scale):
+            if scale is None:
+                self.image = self.raw_image
+            else:
+                self.image = np.zeros(self.raw_image.shape, dtype=np.float32)
+                scale(self.raw_image, out=self.image, where=self.raw_image > 0)
+            self.scaled_key = (self.version, scale)
+        return self.image
+
+    def raw_index(self, x, y):
+        """
+        maps the pixel at (x, y) in the view to its index in the image
+        """
+        point = self.imageItem.mapFromView(QtCore.QPointF(x + 0.5, y + 0.5))
+        return int(point.y()), int(point.x())
 
     @pyqtSlot()
     def update_scale(self, *args, **kwargs):
         if self.raw_image is None:
             return
-        if self.view.menu.logScale.isChecked():
-            self.raw_image = np.log(self.raw_image, where=self.raw_image > 0)
-        elif self.view.menu.sqrtScale.isChecked():
-            self.raw_image = np.sqrt(self.raw_image, where=self.raw_image > 0)
         auto_levels = self.view.menu.autoLevels.isChecked()
-        super().setImage(self.raw_image, *args, autoLevels=auto_levels,
-                         autoHistogramRange=auto_levels, autoRange=False, **kwargs)
+        self.__display(self.__scaled(), *args, autoLevels=auto_levels, autoHistogramRange=auto_levels, **kwargs)
 
     @pyqtSlot(tuple)
     def __callback_move(self, evt):
@@ -247,3 +290,22 @@ class ROIView(pg.GraphicsLayoutWidget):
         else:
             for p in self.plots:
                 p.setYLink(None)
+
+
+class LatencyView(pg.GraphicsLayoutWidget):
+    """
+    histograms of the rolling latencies of the stages of a LatencyTracer
+    """
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+        self.setBackground('k')
+        self.curves = {}
+
+    def update_histograms(self, histograms):
+        for stage, (counts, edges) in histograms.items():
+            if stage not in self.curves:
+                n = len(self.curves)
+                plot = self.addPlot(row=n // 3, col=n % 3, title=stage)
+                plot.setLabel('bottom', 'latency', units='ms')
+                self.curves[stage] = plot.plot(stepMode='center', fillLevel=0, brush=(255, 150, 0, 100))
+            self.curves[stage].setData(edges, counts)